@@ -0,0 +1,37 @@
+#!/usr/bin/env python3
+
+# Convert a text sources file (heat.conf format) into the binary format that
+# the solvers read without parsing: the tag HEATSRC1, the int32 values
+# layout.x, layout.y, numSources and numKeyframes, then the HeatSource records
+# (4 floats, firstKeyframe, numKeyframes) and the HeatKeyframe records (step,
+# 4 floats), in native byte order.
+
+import struct
+import sys
+
+if len(sys.argv) != 3:
+	print("Usage: %s input.conf output.bin" % sys.argv[0])
+	sys.exit(1)
+
+with open(sys.argv[1]) as f:
+	lines = [line.split('#')[0].split() for line in f]
+
+layout = [int(v) for v in lines[0][:2]]
+count = int(lines[1][0])
+
+sources = []
+keyframes = []
+for words in lines[2:2 + count]:
+	first = len(keyframes)
+	for k in range(4, len(words), 6):
+		assert words[k] == "at"
+		keyframes.append((int(words[k + 1]),) + tuple(float(v) for v in words[k + 2:k + 6]))
+	sources.append(tuple(float(v) for v in words[:4]) + (first, len(keyframes) - first))
+
+with open(sys.argv[2], "wb") as f:
+	f.write(b"HEATSRC1")
+	f.write(struct.pack("=4i", layout[0], layout[1], len(sources), len(keyframes)))
+	for src in sources:
+		f.write(struct.pack("=4f2i", *src))
+	for key in keyframes:
+		f.write(struct.pack("=i4f", *key))
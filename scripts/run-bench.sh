@@ -0,0 +1,55 @@
+#!/bin/bash
+
+# Benchmark configuration
+repetitions=30
+warmup=3
+sizes="512 1024 2048 4096"
+haloblocks=4
+
+# MPI launcher (two local ranks for the halo ping-pong)
+mpiexec=${MPIEXEC:-mpiexec}
+
+# Machine-readable output (one "bench, ..." line per benchmark)
+outfile=${BENCH_OUTPUT:-bench_output.txt}
+
+if [ "$#" -lt 1 ]; then
+	echo "Usage: $0 bench1 [bench2...]"
+	exit 1
+fi
+
+programs=("$@")
+
+echo ---------------------------------
+echo BENCHMARK SUITE
+echo ---------------------------------
+
+rm -f $outfile
+
+sizeargs=""
+for size in $sizes; do
+	sizeargs="$sizeargs -s $size"
+done
+
+failed=0
+for prog in ${programs[*]}; do
+	if [ ! -f ${prog} ]; then
+		continue;
+	fi
+
+	if [[ $prog == *"_mpi"* ]]; then
+		$mpiexec -n 2 ./${prog} -r $repetitions -w $warmup -b $haloblocks | tee -a $outfile
+	else
+		./${prog} -r $repetitions -w $warmup $sizeargs | tee -a $outfile
+	fi
+
+	if [ ${PIPESTATUS[0]} -ne 0 ]; then
+		failed=$(($failed + 1))
+		echo $prog FAILED
+	fi
+done
+
+echo ---------------------------------
+echo Results written to $outfile
+echo ---------------------------------
+
+exit $failed
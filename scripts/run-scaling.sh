@@ -0,0 +1,188 @@
+#!/bin/bash
+
+# Scaling configuration
+variants="mpi.pure mpi.omp mpi.task mpi.omptask"
+ranks="1 2 4"
+threads="1 2"
+sizes="4096"
+blocksizes="512 1024"
+timesteps=100
+
+# Heat sources are taken from this file; the process layout line is
+# replaced for every rank count
+conffile=${CONF:-heat.conf}
+
+# MPI launcher and the per-rank thread binding (%t is replaced by the number
+# of threads per rank). The OmpSs-2 runtime starts one thread per CPU of the
+# binding, and OpenMP runtimes follow OMP_NUM_THREADS; every run checks the
+# thread count that main reports. Open MPI also gets --oversubscribe so that
+# the matrix can run on a single machine.
+mpiexec=${MPIEXEC:-mpiexec}
+bindflags=${BINDFLAGS:--bind-to hwthread:%t}
+if $mpiexec --version 2>/dev/null | grep -qE "Open ?MPI|OpenRTE|open-mpi"; then
+	mpiexec="$mpiexec --oversubscribe"
+	bindflags=${BINDFLAGS:---map-by slot:PE=%t --bind-to none}
+fi
+
+# Outputs: raw measurements and the efficiency report
+resfile=${SCALING_RESULTS:-scaling_results.csv}
+repfile=${SCALING_REPORT:-scaling_report.txt}
+
+export NANOS6=optimized
+
+tmpconf=.heat_scaling.conf
+failures=0
+
+# Split n ranks into the most square x*y process layout (x <= y)
+layout()
+{
+	local n=$1
+	local x=1
+	for ((i = 1; i * i <= n; i++)); do
+		if [ $((n % i)) -eq 0 ]; then
+			x=$i
+		fi
+	done
+	echo "$x $((n / x))"
+}
+
+# Print the value following KEY in the CSV line printed by main
+field()
+{
+	echo "$1" | awk -F, -v key="$2" '{
+		for (i = 1; i < NF; i++) {
+			k = $i; gsub(/ /, "", k)
+			if (k == key) { v = $(i+1); gsub(/ /, "", v); print v; exit }
+		}
+	}'
+}
+
+# run VARIANT BS MODE RANKS THREADS ROWS COLS
+run()
+{
+	local prog=heat_$1.$2bs.exe
+	local nranks=$4
+	local nthreads=$5
+	local pl=($(layout $nranks))
+
+	{ echo "${pl[0]} ${pl[1]}"; tail -n +2 $conffile; } > $tmpconf
+
+	local flags=""
+	if [[ $1 != "mpi.pure" ]]; then
+		flags=${bindflags//%t/$nthreads}
+	fi
+
+	local out
+	out=$(OMP_NUM_THREADS=$nthreads $mpiexec -n $nranks $flags ./$prog -r $6 -c $7 -t $timesteps -f $tmpconf 2>/dev/null | grep "performance")
+	if [ -z "$out" ]; then
+		echo "$prog $3 ranks=$nranks threads=$nthreads FAILED" >&2
+		failures=$((failures + 1))
+		return
+	fi
+
+	# A run on fewer threads than requested would inflate the efficiency
+	local ran=$(field "$out" threads)
+	if [ "$ran" != "$nthreads" ]; then
+		echo "$prog $3 ranks=$nranks threads=$nthreads FAILED: ran $ran threads per rank" >&2
+		failures=$((failures + 1))
+		return
+	fi
+
+	echo "$1,$2,$3,$nranks,$nthreads,$(field "$out" rows),$(field "$out" cols),$(field "$out" time),$(field "$out" performance)" >> $resfile
+	echo "$1 bs=$2 $3 ranks=$nranks threads=$nthreads size=$(field "$out" rows)x$(field "$out" cols) performance=$(field "$out" performance)"
+}
+
+if [ ! -f $conffile ]; then
+	echo "Configuration file $conffile not found!"
+	exit 1
+fi
+
+echo ---------------------------------
+echo SCALING SUITE
+echo ---------------------------------
+
+echo "variant,bs,mode,ranks,threads,rows,cols,time,performance" > $resfile
+
+for bs in $blocksizes; do
+	for variant in $variants; do
+		prog=heat_$variant.${bs}bs.exe
+		if [ ! -f $prog ]; then
+			make $prog BSX=$bs > /dev/null 2>&1
+		fi
+		if [ ! -f $prog ]; then
+			echo "$prog cannot be built, skipping"
+			continue
+		fi
+
+		vthreads=$threads
+		if [[ $variant == "mpi.pure" ]]; then
+			vthreads=1
+		fi
+
+		for size in $sizes; do
+			for nthreads in $vthreads; do
+				for nranks in $ranks; do
+					pl=($(layout $nranks))
+
+					# Strong scaling: the global grid is fixed
+					run $variant $bs strong $nranks $nthreads $size $size
+
+					# Weak scaling: every rank keeps a size x size tile
+					run $variant $bs weak $nranks $nthreads $((size * ${pl[0]})) $((size * ${pl[1]}))
+				done
+			done
+		done
+	done
+done
+
+rm -f $tmpconf
+
+# Efficiency report. The baseline of each series is its run with the fewest
+# cores (ranks x threads); strong efficiency compares performance per core,
+# weak efficiency compares time to solution.
+awk -F, '
+NR == 1 { next }
+{
+	key = $1 "," $2 "," $3 "," $5 "," ($3 == "strong" ? $6 "x" $7 : "tile")
+	cores = $4 * $5
+	if (!(key in base) || cores < basecores[key]) {
+		base[key] = $9; basetime[key] = $8; basecores[key] = cores
+	}
+	rows[NR] = $0; keys[NR] = key
+	best = $2 "," $3 "," $4 "," $5 "," $6 "x" $7
+	if (!(best in cmp)) order[++ncmp] = best
+	cmp[best] = cmp[best] sprintf(" %s=%s", $1, $9)
+	if (!(best in bestperf) || $9 > bestperf[best]) { bestperf[best] = $9; bestvar[best] = $1 }
+}
+END {
+	printf("%-9s %5s %-6s %5s %7s %11s %10s %12s %8s %10s\n", "variant", "bs", "mode", "ranks", "threads", "size", "time", "performance", "speedup", "efficiency")
+	for (i = 2; i <= NR; i++) {
+		if (!(i in rows)) continue
+		split(rows[i], f, ",")
+		k = keys[i]
+		cores = f[4] * f[5]
+		if (f[3] == "strong") {
+			speedup = f[9] / base[k]
+			eff = speedup * basecores[k] / cores
+		} else {
+			speedup = f[9] / base[k]
+			eff = basetime[k] / f[8]
+		}
+		printf("%-9s %5s %-6s %5s %7s %11s %10.4f %12.2f %8.2f %9.1f%%\n", f[1], f[2], f[3], f[4], f[5], f[6] "x" f[7], f[8], f[9], speedup, 100 * eff)
+	}
+	printf("\nVariant comparison (performance in Melements/s)\n")
+	for (j = 1; j <= ncmp; j++) {
+		b = order[j]
+		split(b, f, ",")
+		printf("bs=%s %s ranks=%s threads=%s size=%s:%s  best=%s\n", f[1], f[2], f[3], f[4], f[5], cmp[b], bestvar[b])
+	}
+}' $resfile | tee $repfile
+
+echo ---------------------------------
+echo Results written to $resfile and $repfile
+echo ---------------------------------
+
+if [ $failures -gt 0 ]; then
+	echo "$failures runs failed and are missing from the report" >&2
+	exit 1
+fi
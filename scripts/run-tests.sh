@@ -16,6 +16,13 @@ fi
 
 programs=("$@")
 
+# Options that must not change the results, checked on top of the default
+# run: active-block skipping and padded blocks in the single-process
+# versions; active-block skipping, compressed halos and rebalancing in the
+# MPI versions
+smp_options=("-a" "-p")
+mpi_options=("-a" "-z all" "-b 10")
+
 export NANOS6=optimized
 
 reffile=.heat_ref.ppm
@@ -28,6 +35,7 @@ echo ---------------------------------
 total=0
 failed=0
 
+# The first sequential program gives the reference results
 seq_prog=false
 for prog in ${programs[*]}; do
 	if [[ $prog == *"_seq"* ]] && [ -f ${prog} ]; then
@@ -37,6 +45,7 @@ for prog in ${programs[*]}; do
 			exit 1
 		fi
 		seq_prog=true
+		break
 	fi
 done
 
@@ -50,32 +59,42 @@ for prog in ${programs[*]}; do
 	if [ ! -f ${prog} ]; then
 		continue;
 	fi
-	total=$(($total + 1))
 
-	# Execution
-	if [[ $prog == *"_mpi.pure"* ]] || [[ $prog == *"_gaspi.pure"* ]]; then
-		mpiexec.hydra -n $totalthreads ./${prog} -s $size -t $timesteps -o$tmpfile > /dev/null
-	elif [[ $prog == *"_mpi"* ]]; then
-		mpiexec.hydra -n $nprocs -bind-to hwthread:$nthreadsxproc ./${prog} -s $size -t $timesteps -o$tmpfile > /dev/null
+	if [[ $prog == *"_mpi"* ]] || [[ $prog == *"_gaspi"* ]]; then
+		options=("" "${mpi_options[@]}")
 	else
-		./${prog} -s $size -t $timesteps -o$tmpfile > /dev/null
+		options=("" "${smp_options[@]}")
 	fi
 
-	# Check the return value of the program
-	if [ $? -ne 0 ]; then
-		failed=$(($failed + 1))
-		echo $prog FAILED
-		continue;
-	fi
+	for opts in "${options[@]}"; do
+		total=$(($total + 1))
+		name="$prog${opts:+ $opts}"
+
+		# Execution
+		if [[ $prog == *"_mpi.pure"* ]] || [[ $prog == *"_gaspi.pure"* ]]; then
+			mpiexec.hydra -n $totalthreads ./${prog} -s $size -t $timesteps $opts -o$tmpfile > /dev/null
+		elif [[ $prog == *"_mpi"* ]]; then
+			mpiexec.hydra -n $nprocs -bind-to hwthread:$nthreadsxproc ./${prog} -s $size -t $timesteps $opts -o$tmpfile > /dev/null
+		else
+			./${prog} -s $size -t $timesteps $opts -o$tmpfile > /dev/null
+		fi
 
-	# Result checking
-	diff $reffile $tmpfile > /dev/null
-	if [ $? -eq 0 ]; then
-		echo $prog PASSED
-	else
-		failed=$(($failed + 1))
-		echo $prog FAILED
-	fi
+		# Check the return value of the program
+		if [ $? -ne 0 ]; then
+			failed=$(($failed + 1))
+			echo $name FAILED
+			continue;
+		fi
+
+		# Result checking
+		diff $reffile $tmpfile > /dev/null
+		if [ $? -eq 0 ]; then
+			echo $name PASSED
+		else
+			failed=$(($failed + 1))
+			echo $name FAILED
+		fi
+	done
 done
 
 echo ---------------------------------
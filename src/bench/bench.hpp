@@ -0,0 +1,84 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+// Monotonic clock with nanosecond resolution (get_time is too coarse for
+// single-block measurements)
+inline double bench_time()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+struct BenchOptions {
+	int repetitions;
+	int warmup;
+
+	BenchOptions() :
+		repetitions(30),
+		warmup(3)
+	{
+	}
+};
+
+// Nearest-rank percentile of an already sorted sample
+inline double percentile(const std::vector<double> &sorted, double p)
+{
+	if (sorted.empty()) return 0.0;
+
+	size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.5);
+	rank = std::min(std::max(rank, (size_t)1), sorted.size());
+	return sorted[rank - 1];
+}
+
+// Run func warmup + repetitions times and return the timings of the measured
+// runs. The setup functor is executed before each run and is not timed.
+template <typename Setup, typename Func>
+inline std::vector<double> measure(const BenchOptions &opts, Setup setup, Func func)
+{
+	std::vector<double> samples;
+	samples.reserve(opts.repetitions);
+
+	for (int i = 0; i < opts.warmup + opts.repetitions; ++i) {
+		setup();
+		double start = bench_time();
+		func();
+		double end = bench_time();
+		if (i >= opts.warmup) samples.push_back(end - start);
+	}
+
+	std::sort(samples.begin(), samples.end());
+	return samples;
+}
+
+template <typename Func>
+inline std::vector<double> measure(const BenchOptions &opts, Func func)
+{
+	return measure(opts, [](){}, func);
+}
+
+// Print one result line in the same "key, value" CSV format used by the
+// solvers. Times are reported in microseconds. A positive work value (in
+// elements) adds the throughput of the median run in Melements/s.
+inline void report(const char *name, const std::vector<double> &sorted, long size, long work)
+{
+	double median = percentile(sorted, 50.0);
+
+	fprintf(stdout, "bench, %s, size, %ld, bs, %d, reps, %zu, min, %f, median, %f, p90, %f, p99, %f, max, %f, performance, %f\n",
+		name, size, BSX, sorted.size(),
+		1e6 * sorted.front(),
+		1e6 * median,
+		1e6 * percentile(sorted, 90.0),
+		1e6 * percentile(sorted, 99.0),
+		1e6 * sorted.back(),
+		(work > 0 && median > 0.0) ? work / median / 1000000.0 : 0.0);
+	fflush(stdout);
+}
+
+#endif // BENCH_HPP
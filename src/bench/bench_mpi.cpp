@@ -0,0 +1,120 @@
+#include <mpi.h>
+#include <cassert>
+#include <cstdlib>
+#include <getopt.h>
+#include <vector>
+
+#include "common/heat.hpp"
+#include "bench/bench.hpp"
+#include "mpi/borders.hpp"
+
+
+static void printUsage(char **argv)
+{
+	fprintf(stdout, "Usage: mpiexec -n 2 %s [OPTION]...\n", argv[0]);
+	fprintf(stdout, "  -r, --repetitions=N\tmeasured round trips per benchmark (default: 30)\n");
+	fprintf(stdout, "  -w, --warmup=N\t\tunmeasured round trips before measuring (default: 3)\n");
+	fprintf(stdout, "  -b, --blocks=N\t\tnumber of blocks along the exchanged edge (default: 4)\n");
+	fprintf(stdout, "  -h, --help\t\t\tdisplay this help and exit\n");
+}
+
+// Communicator of the halo helpers
+MPI_Comm gridComm = MPI_COMM_WORLD;
+
+int main(int argc, char **argv)
+{
+	MPI_Init(&argc, &argv);
+
+	int rank, rank_size;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &rank_size);
+
+	static struct option long_options[] = {
+		{"repetitions", required_argument, 0, 'r'},
+		{"warmup",      required_argument, 0, 'w'},
+		{"blocks",      required_argument, 0, 'b'},
+		{"help",        no_argument,       0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	BenchOptions opts;
+	int blocks = 4;
+
+	int c;
+	int index;
+	while ((c = getopt_long(argc, argv, "hr:w:b:", long_options, &index)) != -1) {
+		switch (c) {
+			case 'h':
+				if (!rank) printUsage(argv);
+				MPI_Finalize();
+				return 0;
+			case 'r':
+				opts.repetitions = atoi(optarg);
+				break;
+			case 'w':
+				opts.warmup = atoi(optarg);
+				break;
+			case 'b':
+				blocks = atoi(optarg);
+				break;
+			default:
+				if (!rank) printUsage(argv);
+				MPI_Finalize();
+				return 1;
+		}
+	}
+
+	if (rank_size != 2 || opts.repetitions <= 0 || blocks <= 0) {
+		if (!rank) printUsage(argv);
+		MPI_Finalize();
+		return 1;
+	}
+
+	// A square tile of blocks x blocks blocks per rank, as in the solvers
+	int nbx = blocks;
+	int nby = blocks;
+
+	block_t *matrix = (block_t *) calloc(nbx * nby, sizeof(block_t));
+	row_t *haloRow = (row_t *) calloc(HaloDepth * nby, sizeof(row_t));
+	col_t *haloCol = (col_t *) calloc(HaloDepth * nbx, sizeof(col_t));
+	if (matrix == NULL || haloRow == NULL || haloCol == NULL) {
+		fprintf(stderr, "Error: Memory cannot be allocated!\n");
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	HeatConfiguration conf;
+	conf.rowBlocks = nbx;
+	conf.colBlocks = nby;
+
+	// Each round trip runs the solver helpers of one Gauss-Seidel step
+	// between two ranks: stacked for the rows, side by side for the columns
+	std::vector<double> samples;
+
+	conf.processLayout.x = 2;
+	conf.processLayout.y = 1;
+	ProcessLayout rowRank(rank, 0);
+	samples = measure(opts, [&]() {
+		MPI_Barrier(MPI_COMM_WORLD);
+		if (rank) { sendFirstComputeRow(matrix, nbx, nby, rowRank, conf); receiveUpperBorder(haloRow, nbx, nby, rowRank, conf); }
+		else      { receiveLowerBorder(haloRow, nbx, nby, rowRank, conf); sendLastComputeRow(matrix, nbx, nby, rowRank, conf); }
+	});
+	if (!rank) report("halo.sendFirstComputeRow-receiveLowerBorder-sendLastComputeRow-receiveUpperBorder", samples, blocks, 2L * HaloDepth * nby * BSY);
+
+	conf.processLayout.x = 1;
+	conf.processLayout.y = 2;
+	ProcessLayout colRank(0, rank);
+	samples = measure(opts, [&]() {
+		MPI_Barrier(MPI_COMM_WORLD);
+		if (rank) { sendLeftBorder(haloCol, nbx, nby, colRank, conf); receiveLeftBorder(haloCol, nbx, nby, colRank, conf); }
+		else      { receiveRightBorder(haloCol, nbx, nby, colRank, conf); sendRightBorder(haloCol, nbx, nby, colRank, conf); }
+	});
+	if (!rank) report("halo.sendLeftBorder-receiveRightBorder-sendRightBorder-receiveLeftBorder", samples, blocks, 2L * HaloDepth * nbx * BSX);
+
+	free(matrix);
+	free(haloRow);
+	free(haloCol);
+
+	MPI_Finalize();
+
+	return 0;
+}
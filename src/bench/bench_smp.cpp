@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <vector>
+
+#include "common/heat.hpp"
+#include "bench/bench.hpp"
+
+
+static void printUsage(char **argv)
+{
+	fprintf(stdout, "Usage: %s [OPTION]...\n", argv[0]);
+	fprintf(stdout, "  -r, --repetitions=N\tmeasured runs per benchmark (default: 30)\n");
+	fprintf(stdout, "  -w, --warmup=N\t\tunmeasured runs before measuring (default: 3)\n");
+	fprintf(stdout, "  -s, --size=SIZE\t\tadd a SIZExSIZE grid to the sweep benchmarks (default: 512 1024 2048 4096)\n");
+	fprintf(stdout, "  -n, --sources=N\t\tnumber of heat sources used by the initialization benchmark (default: 2)\n");
+	fprintf(stdout, "  -o, --output=NAME\t\timage file written by the image benchmark (default: /dev/null)\n");
+	fprintf(stdout, "  -h, --help\t\t\tdisplay this help and exit\n");
+}
+
+// Build a configuration of SIZExSIZE elements with allocated grid and halos
+static HeatConfiguration makeConfiguration(int size, HeatSource *sources, int numSources)
+{
+	HeatConfiguration conf;
+	conf.rows = round(size, BSX);
+	conf.cols = round(size, BSY);
+	conf.timesteps = 1;
+	conf.rowBlocks = conf.rows / BSX;
+	conf.colBlocks = conf.cols / BSY;
+	conf.numHeatSources = numSources;
+	conf.heatSources = sources;
+
+	int err = initialize(conf, conf.rowBlocks, conf.colBlocks);
+	assert(!err);
+
+	return conf;
+}
+
+// Touch a buffer larger than the last-level cache to evict the grid
+static void flushCaches(std::vector<char> &buffer)
+{
+	for (size_t i = 0; i < buffer.size(); i += 64) {
+		buffer[i]++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"repetitions", required_argument, 0, 'r'},
+		{"warmup",      required_argument, 0, 'w'},
+		{"size",        required_argument, 0, 's'},
+		{"sources",     required_argument, 0, 'n'},
+		{"output",      required_argument, 0, 'o'},
+		{"help",        no_argument,       0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	BenchOptions opts;
+	std::vector<int> sizes;
+	int numSources = 2;
+	std::string imageFileName = "/dev/null";
+
+	int c;
+	int index;
+	while ((c = getopt_long(argc, argv, "hr:w:s:n:o:", long_options, &index)) != -1) {
+		switch (c) {
+			case 'h':
+				printUsage(argv);
+				return 0;
+			case 'r':
+				opts.repetitions = atoi(optarg);
+				break;
+			case 'w':
+				opts.warmup = atoi(optarg);
+				break;
+			case 's':
+				sizes.push_back(atoi(optarg));
+				break;
+			case 'n':
+				numSources = atoi(optarg);
+				break;
+			case 'o':
+				imageFileName = optarg;
+				break;
+			default:
+				printUsage(argv);
+				return 1;
+		}
+	}
+
+	if (opts.repetitions <= 0 || numSources <= 0) {
+		printUsage(argv);
+		return 1;
+	}
+
+	if (sizes.empty()) {
+		sizes = {512, 1024, 2048, 4096};
+	}
+
+	// Heat sources spread along the diagonal, always reaching the boundary
+	std::vector<HeatSource> sources(numSources);
+	for (int i = 0; i < numSources; ++i) {
+		sources[i].row = (numSources > 1) ? (float) i / (numSources - 1) : 0.0f;
+		sources[i].col = sources[i].row;
+		sources[i].range = 1.0f;
+		sources[i].temperature = 2.5f;
+	}
+
+	std::vector<char> flushBuffer(256 * 1024 * 1024);
+
+	// Single block: one solveBlock call per run
+	{
+		HeatConfiguration conf = makeConfiguration(BSX, sources.data(), numSources);
+		long work = (long) BSX * BSY;
+
+		std::vector<double> hot = measure(opts, [&]() {
+			solve(conf.matrix, 1, 1, conf, conf.halos_row, conf.halos_col);
+		});
+		report("kernel.hot", hot, BSX, work);
+
+		std::vector<double> cold = measure(opts,
+			[&]() { flushCaches(flushBuffer); },
+			[&]() { solve(conf.matrix, 1, 1, conf, conf.halos_row, conf.halos_col); }
+		);
+		report("kernel.cold", cold, BSX, work);
+
+		finalize(conf);
+	}
+
+	for (size_t i = 0; i < sizes.size(); ++i) {
+		HeatConfiguration conf = makeConfiguration(sizes[i], sources.data(), numSources);
+		long work = (long) conf.rows * conf.cols;
+
+		// One full Gauss-Seidel sweep over the grid
+		std::vector<double> sweep = measure(opts, [&]() {
+			solve(conf.matrix, conf.rowBlocks, conf.colBlocks, conf, conf.halos_row, conf.halos_col);
+		});
+		report("sweep", sweep, conf.rows, work);
+
+		// Boundary initialization from the heat sources
+		std::vector<double> halos = measure(opts,
+			[&]() {
+				memset(conf.halos_row[top],    0, conf.colBlocks * sizeof(row_t));
+				memset(conf.halos_row[bottom], 0, conf.colBlocks * sizeof(row_t));
+				memset(conf.halos_col[left],   0, conf.rowBlocks * sizeof(col_t));
+				memset(conf.halos_col[right],  0, conf.rowBlocks * sizeof(col_t));
+			},
+			[&]() { initializeHalos(conf, conf.matrix, conf.rowBlocks, conf.colBlocks); }
+		);
+		report("initializeHalos", halos, conf.rows, 2L * (conf.rows + conf.cols));
+
+		// Image output (text PPM, kept to a few runs)
+		BenchOptions imageOpts;
+		imageOpts.repetitions = std::min(opts.repetitions, 5);
+		imageOpts.warmup = std::min(opts.warmup, 1);
+		std::vector<double> image = measure(imageOpts, [&]() {
+			writeImage(imageFileName, conf.matrix, conf.rowBlocks, conf.colBlocks, conf.rows, conf.cols);
+		});
+		report("writeImage", image, conf.rows, work);
+
+		finalize(conf);
+	}
+
+	return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef ACTIVITY_HPP
+#define ACTIVITY_HPP
+
+#include <cmath>
+
+#include "common/heat.hpp"
+#include "common/stencil.hpp"
+
+// Active-region tracking for the Gauss-Seidel sweeps. change[b] holds the
+// sum of squared updates of block b in its last sweep. A block whose own
+// and whose neighbours' last changes are all within the tolerance would
+// recompute its current values (exactly so for a zero tolerance), so the
+// sweep skips it and records no change. Heat spreads from the halos as the
+// blocks next to changed ones become active; with a diagonal stencil, the
+// diagonal neighbours count too.
+
+// Blocks whose halos are received from another rank every step
+inline bool hasRemoteHalo(int nbx, int nby, int bx, int by, ProcessLayout rank2D, const HeatConfiguration &conf)
+{
+	return (bx == 0     && rank2D.x != 0)
+		|| (bx == nbx-1 && rank2D.x != conf.processLayout.x-1)
+		|| (by == 0     && rank2D.y != 0)
+		|| (by == nby-1 && rank2D.y != conf.processLayout.y-1);
+}
+
+// Changes of the diagonal neighbours, which only a diagonal stencil reads
+inline bool isDiagonalActive(const double *change, int nbx, int nby, int bx, int by, double tolerance)
+{
+	return (bx > 0     && by > 0     && change[blockIndex(bx-1, by-1, nbx, nby)] > tolerance)
+		|| (bx > 0     && by < nby-1 && change[blockIndex(bx-1, by+1, nbx, nby)] > tolerance)
+		|| (bx < nbx-1 && by > 0     && change[blockIndex(bx+1, by-1, nbx, nby)] > tolerance)
+		|| (bx < nbx-1 && by < nby-1 && change[blockIndex(bx+1, by+1, nbx, nby)] > tolerance);
+}
+
+inline bool isBlockActive(const double *change, int nbx, int nby, int bx, int by, double tolerance)
+{
+	return change[blockIndex(bx, by, nbx, nby)] > tolerance
+		|| (bx > 0     && change[blockIndex(bx-1, by, nbx, nby)] > tolerance)
+		|| (bx < nbx-1 && change[blockIndex(bx+1, by, nbx, nby)] > tolerance)
+		|| (by > 0     && change[blockIndex(bx, by-1, nbx, nby)] > tolerance)
+		|| (by < nby-1 && change[blockIndex(bx, by+1, nbx, nby)] > tolerance)
+		|| (Stencil::diagonal && isDiagonalActive(change, nbx, nby, bx, by, tolerance));
+}
+
+inline bool isHaloSegmentZero(const real_t *segment, int length)
+{
+	for (int i = 0; i < length; ++i) {
+		if (segment[i] != 0) return false;
+	}
+	return true;
+}
+
+// A grid that starts at zero only changes in the first sweep in the blocks
+// next to a non-zero boundary segment; from an initial guess, every block can
+inline void initializeActivity(const HeatConfiguration &conf, double *change, int nbx, int nby, ProcessLayout rank2D)
+{
+	for (int bx = 0; bx < nbx; ++bx) {
+		for (int by = 0; by < nby; ++by) {
+			bool active = (conf.initialGuess != GUESS_NONE)
+				|| (bx == 0     && !isHaloSegmentZero(conf.halos_row[top]   [by], BSY))
+				|| (bx == nbx-1 && !isHaloSegmentZero(conf.halos_row[bottom][by], BSY))
+				|| (by == 0     && !isHaloSegmentZero(conf.halos_col[left]  [bx], BSX))
+				|| (by == nby-1 && !isHaloSegmentZero(conf.halos_col[right] [bx], BSX));
+
+			change[blockIndex(bx, by, nbx, nby)] = (active || hasRemoteHalo(nbx, nby, bx, by, rank2D, conf)) ? HUGE_VAL : 0.0;
+		}
+	}
+}
+
+#endif // ACTIVITY_HPP
@@ -0,0 +1,166 @@
+#ifndef BLOCKORDER_HPP
+#define BLOCKORDER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Storage order of the blocks of a grid (build with ORDER=morton or
+// ORDER=hilbert). Block (bx, by) of an nbx x nby grid is stored at
+// blockIndex(bx, by, nbx, nby); in the curve orders, blocks that are close in
+// the grid are also close in memory.
+#define HEAT_ORDER_ROWS    0
+#define HEAT_ORDER_MORTON  1
+#define HEAT_ORDER_HILBERT 2
+
+#ifndef HEAT_BLOCK_ORDER
+#define HEAT_BLOCK_ORDER HEAT_ORDER_ROWS
+#endif
+
+#if HEAT_BLOCK_ORDER != HEAT_ORDER_ROWS
+
+// Morton code: the bits of bx and by interleaved. It grows with each
+// coordinate, so the blocks above and to the left of a block come first.
+inline uint64_t mortonKey(uint32_t bx, uint32_t by, uint32_t side)
+{
+	uint64_t key = 0;
+	for (uint32_t bit = 0; (1u << bit) < side; ++bit) {
+		key |= (uint64_t) ((bx >> bit) & 1) << (2*bit + 1);
+		key |= (uint64_t) ((by >> bit) & 1) << (2*bit);
+	}
+	return key;
+}
+
+// Distance of (bx, by) along the Hilbert curve of a side x side square
+inline uint64_t hilbertKey(uint32_t bx, uint32_t by, uint32_t side)
+{
+	uint64_t key = 0;
+	for (uint32_t s = side / 2; s > 0; s /= 2) {
+		uint32_t rx = (bx & s) ? 1 : 0;
+		uint32_t ry = (by & s) ? 1 : 0;
+		key += (uint64_t) s * s * ((3 * rx) ^ ry);
+		if (ry == 0) {
+			if (rx == 1) {
+				bx = s - 1 - bx;
+				by = s - 1 - by;
+			}
+			std::swap(bx, by);
+		}
+	}
+	return key;
+}
+
+// Curve positions of the blocks of an nbx x nby grid, compacted so that the
+// blocks fill [0, nbx*nby)
+struct BlockOrder {
+	int nbx;
+	int nby;
+	std::vector<int> slot;   // row-major block -> storage index
+	std::vector<int> block;  // storage index -> row-major block
+
+	BlockOrder(int nbx, int nby) : nbx(nbx), nby(nby), slot(nbx * nby), block(nbx * nby)
+	{
+		uint32_t side = 1;
+		while (side < (uint32_t) std::max(nbx, nby)) side *= 2;
+
+		std::vector<std::pair<uint64_t, int> > keys(nbx * nby);
+		for (int bx = 0; bx < nbx; ++bx) {
+			for (int by = 0; by < nby; ++by) {
+				uint64_t key = (HEAT_BLOCK_ORDER == HEAT_ORDER_MORTON) ? mortonKey(bx, by, side) : hilbertKey(bx, by, side);
+				keys[bx*nby + by] = std::make_pair(key, bx*nby + by);
+			}
+		}
+		std::sort(keys.begin(), keys.end());
+
+		for (int i = 0; i < nbx * nby; ++i) {
+			block[i] = keys[i].second;
+			slot[keys[i].second] = i;
+		}
+	}
+};
+
+// Orders of the most recently used grid shapes; rebalancing produces a new
+// tile shape with every move, so older ones are dropped
+#define BLOCK_ORDER_CACHE 8
+
+// Order of an nbx x nby grid, built on its first use. Each thread keeps the
+// last order it used, so the shared cache and its lock are only touched when
+// a thread switches to another grid shape.
+inline const BlockOrder &getBlockOrder(int nbx, int nby)
+{
+	static std::mutex lock;
+	static std::vector<std::shared_ptr<const BlockOrder> > orders;
+	static thread_local std::shared_ptr<const BlockOrder> last;
+
+	if (last && last->nbx == nbx && last->nby == nby) return *last;
+
+	std::lock_guard<std::mutex> guard(lock);
+	for (const std::shared_ptr<const BlockOrder> &order : orders) {
+		if (order->nbx == nbx && order->nby == nby) {
+			last = order;
+			return *last;
+		}
+	}
+	if (orders.size() == BLOCK_ORDER_CACHE) {
+		orders.erase(orders.begin());
+	}
+	orders.push_back(std::make_shared<const BlockOrder>(nbx, nby));
+	last = orders.back();
+	return *last;
+}
+
+#endif
+
+#if HEAT_BLOCK_ORDER == HEAT_ORDER_ROWS
+
+inline int blockIndex(int bx, int by, int, int nby)
+{
+	return bx*nby + by;
+}
+
+// Block stored at index i, which is also the order of the Jacobi sweeps
+inline void storedBlock(int i, int, int nby, int &bx, int &by)
+{
+	bx = i / nby;
+	by = i % nby;
+}
+
+#else
+
+inline int blockIndex(int bx, int by, int nbx, int nby)
+{
+	return getBlockOrder(nbx, nby).slot[bx*nby + by];
+}
+
+inline void storedBlock(int i, int nbx, int nby, int &bx, int &by)
+{
+	i = getBlockOrder(nbx, nby).block[i];
+	bx = i / nby;
+	by = i % nby;
+}
+
+#endif
+
+// Block visited i-th by the Gauss-Seidel sweeps, which must visit the blocks
+// above and to the left of a block before it. The Morton order does, so with
+// the 5-point and fourth-order stencils its sweeps give the same results as
+// the row-major ones. The 9-point stencil (HEAT_STENCIL 9) also reads the
+// block above and to the right, which the Morton order can visit later, and
+// the Hilbert order does not even keep the blocks above first; their sweeps
+// stay row-major.
+#if HEAT_BLOCK_ORDER == HEAT_ORDER_MORTON && HEAT_STENCIL != 9
+inline void sweepBlock(int i, int nbx, int nby, int &bx, int &by)
+{
+	storedBlock(i, nbx, nby, bx, by);
+}
+#else
+inline void sweepBlock(int i, int, int nby, int &bx, int &by)
+{
+	bx = i / nby;
+	by = i % nby;
+}
+#endif
+
+#endif // BLOCKORDER_HPP
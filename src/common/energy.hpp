@@ -0,0 +1,118 @@
+#ifndef ENERGY_HPP
+#define ENERGY_HPP
+
+#include <dirent.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Energy measurement (-E) with the RAPL counters of the Linux powercap
+// interface (/sys/class/powercap, or the directory in HEAT_POWERCAP). The
+// package and DRAM zones of every socket are read before and after the
+// solve; a counter that went back has wrapped at its max_energy_range_uj,
+// which takes minutes at full load. Without the interface, or without
+// permission to read it, the meter has no zones and measures nothing.
+enum EnergyDomain {
+	ENERGY_PACKAGE,
+	ENERGY_DRAM,
+	NUM_ENERGY_DOMAINS
+};
+
+struct EnergyZone {
+	std::string counter;
+	EnergyDomain domain;
+	uint64_t range;
+	uint64_t start;
+};
+
+struct EnergyMeter {
+	std::vector<EnergyZone> zones;
+};
+
+inline bool readEnergyValue(const std::string &fileName, uint64_t &value)
+{
+	FILE *file = fopen(fileName.c_str(), "r");
+	if (file == nullptr) return false;
+
+	unsigned long long read;
+	bool valid = (fscanf(file, "%llu", &read) == 1);
+	fclose(file);
+	if (valid) {
+		value = read;
+	}
+	return valid;
+}
+
+// Add the zone in path if it is a package or DRAM zone that can be read
+inline void addEnergyZone(EnergyMeter &meter, const std::string &path)
+{
+	char name[64];
+	FILE *file = fopen((path + "/name").c_str(), "r");
+	if (file == nullptr) return;
+	bool named = (fscanf(file, "%63s", name) == 1);
+	fclose(file);
+	if (!named) return;
+
+	EnergyZone zone;
+	if (std::string(name).compare(0, 7, "package") == 0) {
+		zone.domain = ENERGY_PACKAGE;
+	} else if (std::string(name) == "dram") {
+		zone.domain = ENERGY_DRAM;
+	} else {
+		return;
+	}
+
+	zone.counter = path + "/energy_uj";
+	if (readEnergyValue(path + "/max_energy_range_uj", zone.range) && readEnergyValue(zone.counter, zone.start)) {
+		meter.zones.push_back(zone);
+	}
+}
+
+// Find the zones and read their counters. The packages (intel-rapl:P) and
+// their subzones (intel-rapl:P:S) are all linked from the top directory.
+inline void startEnergy(EnergyMeter &meter)
+{
+	const char *variable = getenv("HEAT_POWERCAP");
+	const std::string root = (variable != nullptr) ? variable : "/sys/class/powercap";
+
+	meter.zones.clear();
+	DIR *dir = opendir(root.c_str());
+	if (dir == nullptr) return;
+
+	while (struct dirent *entry = readdir(dir)) {
+		const std::string name = entry->d_name;
+		if (name.compare(0, 11, "intel-rapl:") == 0) {
+			addEnergyZone(meter, root + "/" + name);
+		}
+	}
+	closedir(dir);
+}
+
+// Joules used in each domain since startEnergy
+inline void stopEnergy(const EnergyMeter &meter, double joules[NUM_ENERGY_DOMAINS])
+{
+	for (int d = 0; d < NUM_ENERGY_DOMAINS; ++d) {
+		joules[d] = 0.0;
+	}
+
+	for (const EnergyZone &zone : meter.zones) {
+		uint64_t end;
+		if (!readEnergyValue(zone.counter, end)) continue;
+
+		const uint64_t used = (end >= zone.start) ? end - zone.start : zone.range - zone.start + end;
+		joules[zone.domain] += used * 1e-6;
+	}
+}
+
+// Fields appended to the result line: the energy of each domain and of both,
+// the average power and the cell updates per joule
+inline void printEnergy(const double joules[NUM_ENERGY_DOMAINS], double seconds, double cellUpdates)
+{
+	const double total = joules[ENERGY_PACKAGE] + joules[ENERGY_DRAM];
+	fprintf(stdout, ", package_energy, %f, dram_energy, %f, energy, %f, power, %f, cells_per_joule, %f",
+		joules[ENERGY_PACKAGE], joules[ENERGY_DRAM], total, total / seconds, (total > 0.0) ? cellUpdates / total : 0.0);
+}
+
+#endif // ENERGY_HPP
@@ -0,0 +1,133 @@
+#ifndef ENSEMBLE_HPP
+#define ENSEMBLE_HPP
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "common/heat.hpp"
+#include "common/activity.hpp"
+#include "common/field.hpp"
+
+// Ensemble mode (-e LIST): one case per heat sources file listed in LIST, all
+// with the grid size, timesteps and solver options of the command line. The
+// cases are solved on a pool of grids that are allocated once and reset
+// between cases, so a case costs no process start and no allocation.
+
+// Sources files of the cases, one per line; blank lines and lines starting
+// with '#' are skipped
+inline std::vector<std::string> readEnsembleList(const std::string &fileName)
+{
+	std::ifstream file(fileName);
+	if (!file.is_open()) {
+		fprintf(stderr, "Error: Ensemble file %s not found!\n", fileName.c_str());
+		exit(1);
+	}
+
+	std::vector<std::string> cases;
+	std::string line;
+	while (std::getline(file, line)) {
+		size_t begin = line.find_first_not_of(" \t\r");
+		if (begin == std::string::npos || line[begin] == '#') continue;
+		size_t end = line.find_last_not_of(" \t\r");
+		cases.push_back(line.substr(begin, end - begin + 1));
+	}
+
+	if (cases.empty()) {
+		fprintf(stderr, "Error: Ensemble file %s lists no cases!\n", fileName.c_str());
+		exit(1);
+	}
+	return cases;
+}
+
+// heat.ppm becomes heat.CASE.ppm, and heat.fld becomes heat.CASE.fld
+inline std::string caseImageName(const std::string &imageFileName, int c)
+{
+	size_t dot = imageFileName.rfind('.');
+	if (dot == std::string::npos || imageFileName.find('/', dot) != std::string::npos) {
+		return imageFileName + "." + std::to_string(c);
+	}
+	return imageFileName.substr(0, dot) + "." + std::to_string(c) + imageFileName.substr(dot);
+}
+
+// Pool entry: a copy of the configuration with its own grid, halos and
+// solver buffers
+inline void initializeSlot(HeatConfiguration &slot, const HeatConfiguration &conf, int rowBlocks, int colBlocks)
+{
+	slot = conf;
+	slot.numHeatSources = 0;
+	slot.heatSources = nullptr;
+	int err = initialize(slot, rowBlocks, colBlocks);
+	assert(!err);
+}
+
+inline void finalizeSlot(HeatConfiguration &slot)
+{
+	int err = finalize(slot);
+	assert(!err);
+	free(slot.heatSources);
+	slot.heatSources = nullptr;
+}
+
+// Reset a slot to the initial state of case c and solve it. Returns the time
+// spent on the case.
+inline double solveCase(HeatConfiguration &slot, int rowBlocks, int colBlocks, const std::string &sourcesFile, int c)
+{
+	double start = get_time();
+
+	const ProcessLayout layout = slot.processLayout;
+	free(slot.heatSources);
+	slot.heatSources = nullptr;
+	slot.confFileName = sourcesFile;
+	readSourcesFile(slot);
+	slot.processLayout = layout;
+
+	slot.step = 0;
+	initializeMatrix(slot, slot.matrix, rowBlocks, colBlocks);
+	slot.paddedCurrent = false;
+	memset(slot.halos_row[top],    0, colBlocks * sizeof(row_t));
+	memset(slot.halos_row[bottom], 0, colBlocks * sizeof(row_t));
+	memset(slot.halos_col[left],   0, rowBlocks * sizeof(col_t));
+	memset(slot.halos_col[right],  0, rowBlocks * sizeof(col_t));
+	initializeHalos(slot, slot.matrix, rowBlocks, colBlocks);
+	if (slot.blockChange != nullptr) {
+		initializeActivity(slot, slot.blockChange, rowBlocks, colBlocks, ProcessLayout(0, 0));
+	}
+
+	solve(slot.matrix, rowBlocks, colBlocks, slot, slot.halos_row, slot.halos_col);
+
+	if (slot.generateImage) {
+		int err = writeImage(caseImageName(slot.imageFileName, c), slot.matrix, rowBlocks, colBlocks, slot.rows, slot.cols);
+		assert(!err);
+	}
+	if (slot.generateField) {
+		writeField(caseImageName(slot.fieldFileName, c), slot.matrix, rowBlocks, colBlocks, slot.rows, slot.cols, slot.compressField);
+	}
+
+	return get_time() - start;
+}
+
+// One line per case, followed by the throughput of the whole ensemble
+inline void printEnsemble(const HeatConfiguration &conf, const std::vector<std::string> &cases, const std::vector<double> &times,
+		int ranks, int slots, double elapsed)
+{
+	for (size_t c = 0; c < cases.size(); ++c) {
+		fprintf(stdout, "case, %zu, sources, %s, time, %f\n", c, cases[c].c_str(), times[c]);
+	}
+
+	long totalElements = (long) conf.rows * (long) conf.cols * (long) cases.size();
+	double performance = totalElements * (long) conf.timesteps;
+	performance = performance / elapsed;
+	performance = performance / 1000000.0;
+
+	fprintf(stdout, "ensemble, cases, %zu, rows, %d, cols, %d, bs, %d, ranks, %d, slots, %d, timesteps, %d, time, %f"
+			", cases_per_second, %f, performance, %f\n",
+			cases.size(), conf.rows, conf.cols, BSX, ranks, slots, conf.timesteps, elapsed,
+			cases.size() / elapsed, performance);
+}
+
+#endif // ENSEMBLE_HPP
@@ -0,0 +1,254 @@
+#ifndef FIELD_HPP
+#define FIELD_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "common/matrix.hpp"
+#include "common/words.hpp"
+
+// Field files (-F) keep the grid at full precision as its blocks, so that a
+// region can be read without the rest of the grid:
+//
+//   FieldHeader                        grid and block sizes, value size, flags
+//   FieldTile[rowBlocks * colBlocks]   offset and size of every block, in
+//                                      row-major block order
+//   tiles                              the BSX x BSY values of every block
+//
+// Raw tiles follow the index in row-major block order. Coded tiles
+// (--compress-field) hold each row of the block coded against the row above,
+// the first against zeros, and are stored in the order they were written.
+// The unused cells of the partial blocks are stored too. Values are in the
+// byte order of the writer.
+const char FieldMagic[8] = {'H', 'E', 'A', 'T', 'F', 'L', 'D', '1'};
+
+enum FieldFlags {
+	FIELD_CODED = 1
+};
+
+struct FieldHeader {
+	char magic[8];
+	int32_t rows;
+	int32_t cols;
+	int32_t rowBlocks;
+	int32_t colBlocks;
+	int32_t blockRows;
+	int32_t blockCols;
+	int32_t valueSize;
+	int32_t flags;
+};
+
+struct FieldTile {
+	uint64_t offset;
+	uint64_t size;
+};
+
+inline FieldHeader fieldHeader(int rows, int cols, int rowBlocks, int colBlocks, int blockRows, int blockCols, int valueSize, bool coded)
+{
+	FieldHeader header;
+	memcpy(header.magic, FieldMagic, sizeof(FieldMagic));
+	header.rows = rows;
+	header.cols = cols;
+	header.rowBlocks = rowBlocks;
+	header.colBlocks = colBlocks;
+	header.blockRows = blockRows;
+	header.blockCols = blockCols;
+	header.valueSize = valueSize;
+	header.flags = coded ? FIELD_CODED : 0;
+	return header;
+}
+
+// Offset of the first tile
+inline uint64_t fieldDataOffset(int numTiles)
+{
+	return sizeof(FieldHeader) + (uint64_t) numTiles * sizeof(FieldTile);
+}
+
+// Largest coded tile of blockRows x blockCols values
+template <typename Real>
+inline size_t codedTileSize(int blockRows, int blockCols)
+{
+	return (size_t) blockRows * codedMessageSize<Real>(blockCols);
+}
+
+// Code the rows of a tile into buffer; returns the tile size
+template <typename Real>
+inline size_t encodeTile(const Real *tile, int blockRows, int blockCols, unsigned char *buffer)
+{
+	std::vector<word_t<Real> > previous(blockCols, 0);
+	size_t size = 0;
+	for (int x = 0; x < blockRows; ++x) {
+		size += encodeWords(&tile[(size_t) x * blockCols], previous.data(), blockCols, &buffer[size]);
+	}
+	return size;
+}
+
+template <typename Real>
+inline void decodeTile(const unsigned char *buffer, int blockRows, int blockCols, Real *tile)
+{
+	std::vector<word_t<Real> > previous(blockCols, 0);
+	for (int x = 0; x < blockRows; ++x) {
+		buffer += decodeWords(buffer, previous.data(), blockCols, &tile[(size_t) x * blockCols]);
+	}
+}
+
+inline void fieldFileError(const std::string &fileName)
+{
+	fprintf(stderr, "Error: Field file %s cannot be written!\n", fileName.c_str());
+	exit(1);
+}
+
+// Write size bytes at offset, retrying the short writes
+inline void writeFieldBytes(int fd, const void *data, size_t size, uint64_t offset, const std::string &fileName)
+{
+	const char *bytes = (const char *) data;
+	while (size > 0) {
+		ssize_t written = pwrite(fd, bytes, size, offset);
+		if (written <= 0) fieldFileError(fileName);
+		bytes += written;
+		size -= written;
+		offset += written;
+	}
+}
+
+// Write the grid of a single process. Each block row is coded and written by
+// a task of its own with pwrite; coded tiles reserve their place at the end
+// of the file once their size is known.
+inline void writeField(const std::string &fileName, const block_t *matrix, int rowBlocks, int colBlocks, int rows, int cols, bool coded)
+{
+	int fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) fieldFileError(fileName);
+
+	const uint64_t dataOffset = fieldDataOffset(rowBlocks * colBlocks);
+	std::vector<FieldTile> index(rowBlocks * colBlocks);
+	std::atomic<uint64_t> end(dataOffset);
+
+	FieldTile *tiles = index.data();
+	std::atomic<uint64_t> *next = &end;
+	for (int bx = 0; bx < rowBlocks; ++bx) {
+		#pragma oss task label(write field row)
+		{
+			std::vector<unsigned char> buffer(coded ? codedTileSize<real_t>(BSX, BSY) : 0);
+			for (int by = 0; by < colBlocks; ++by) {
+				const block_t &block = matrix[blockIndex(bx, by, rowBlocks, colBlocks)];
+				FieldTile &tile = tiles[bx * colBlocks + by];
+				if (coded) {
+					tile.size = encodeTile(&block[0][0], BSX, BSY, buffer.data());
+					tile.offset = next->fetch_add(tile.size);
+					writeFieldBytes(fd, buffer.data(), tile.size, tile.offset, fileName);
+				} else {
+					tile.size = sizeof(block_t);
+					tile.offset = dataOffset + (uint64_t) (bx * colBlocks + by) * sizeof(block_t);
+					writeFieldBytes(fd, block, tile.size, tile.offset, fileName);
+				}
+			}
+		}
+	}
+	#pragma oss taskwait
+
+	FieldHeader header = fieldHeader(rows, cols, rowBlocks, colBlocks, BSX, BSY, sizeof(real_t), coded);
+	writeFieldBytes(fd, &header, sizeof(header), 0, fileName);
+	writeFieldBytes(fd, index.data(), index.size() * sizeof(FieldTile), sizeof(header), fileName);
+	if (close(fd) != 0) fieldFileError(fileName);
+}
+
+// Field file mapped for reading
+struct FieldFile {
+	const unsigned char *map;
+	size_t size;
+	FieldHeader header;
+	const FieldTile *index;
+};
+
+inline void fieldReadError(const std::string &fileName, const char *problem)
+{
+	fprintf(stderr, "Error: Field file %s %s!\n", fileName.c_str(), problem);
+	exit(1);
+}
+
+// Map a field file and check its header and index
+inline FieldFile openFieldFile(const std::string &fileName)
+{
+	FieldFile field;
+	int fd = open(fileName.c_str(), O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0) fieldReadError(fileName, "cannot be read");
+	field.size = info.st_size;
+	if (field.size < sizeof(FieldHeader)) fieldReadError(fileName, "is not a field file");
+
+	field.map = (const unsigned char *) mmap(nullptr, field.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (field.map == MAP_FAILED) fieldReadError(fileName, "cannot be mapped");
+	close(fd);
+
+	FieldHeader &header = field.header;
+	memcpy(&header, field.map, sizeof(header));
+	if (memcmp(header.magic, FieldMagic, sizeof(FieldMagic)) != 0
+			|| (header.valueSize != sizeof(float) && header.valueSize != sizeof(double))
+			|| header.blockRows <= 0 || header.blockCols <= 0 || header.rowBlocks <= 0 || header.colBlocks <= 0
+			|| header.rows > header.rowBlocks * header.blockRows || header.cols > header.colBlocks * header.blockCols) {
+		fieldReadError(fileName, "is not a field file");
+	}
+
+	const int numTiles = header.rowBlocks * header.colBlocks;
+	if (field.size < fieldDataOffset(numTiles)) fieldReadError(fileName, "is truncated");
+	field.index = (const FieldTile *) (field.map + sizeof(FieldHeader));
+
+	const uint64_t rawTile = (uint64_t) header.blockRows * header.blockCols * header.valueSize;
+	for (int t = 0; t < numTiles; ++t) {
+		const FieldTile &tile = field.index[t];
+		if (tile.offset + tile.size > field.size || (!(header.flags & FIELD_CODED) && tile.size != rawTile)) {
+			fieldReadError(fileName, "is truncated");
+		}
+	}
+	return field;
+}
+
+inline void closeFieldFile(FieldFile &field)
+{
+	munmap((void *) field.map, field.size);
+	field.map = nullptr;
+}
+
+// Copy the rows x cols values from (row, col) of a field file whose values
+// are Real into values. Only the blocks that overlap them are read.
+template <typename Real, typename Value>
+inline void readFieldRegion(const FieldFile &field, int row, int col, int rows, int cols, Value *values)
+{
+	const FieldHeader &header = field.header;
+	const int bsx = header.blockRows;
+	const int bsy = header.blockCols;
+	std::vector<Real> tile((size_t) bsx * bsy);
+
+	for (int bx = row / bsx; bx <= (row + rows - 1) / bsx; ++bx) {
+		for (int by = col / bsy; by <= (col + cols - 1) / bsy; ++by) {
+			const FieldTile &entry = field.index[bx * header.colBlocks + by];
+			if (header.flags & FIELD_CODED) {
+				decodeTile(field.map + entry.offset, bsx, bsy, tile.data());
+			} else {
+				memcpy(tile.data(), field.map + entry.offset, tile.size() * sizeof(Real));
+			}
+
+			const int x0 = std::max(row, bx * bsx), x1 = std::min(row + rows, (bx + 1) * bsx);
+			const int y0 = std::max(col, by * bsy), y1 = std::min(col + cols, (by + 1) * bsy);
+			for (int x = x0; x < x1; ++x) {
+				const Real *source = &tile[(size_t) (x - bx * bsx) * bsy];
+				Value *target = &values[(size_t) (x - row) * cols];
+				for (int y = y0; y < y1; ++y) {
+					target[y - col] = source[y - by * bsy];
+				}
+			}
+		}
+	}
+}
+
+#endif // FIELD_HPP
@@ -2,6 +2,7 @@
 #define HEAT_HPP
 
 #include <string>
+#include <vector>
 
 #include "common/matrix.hpp"
 
@@ -12,21 +13,56 @@ inline T round(T a, T b)
 	return ((a + b - 1) / b) * b;
 }
 
+// Position, range and temperature that a heat source reaches at a timestep.
+// A source moves linearly from its initial values to its first keyframe and
+// between consecutive keyframes, and keeps its last keyframe afterwards.
+struct HeatKeyframe {
+	int step;
+	float row;
+	float col;
+	float range;
+	float temperature;
+};
+
 struct HeatSource {
 	float row;
 	float col;
 	float range;
 	float temperature;
+	int firstKeyframe;  // in HeatConfiguration::keyframes
+	int numKeyframes;
 	
 	HeatSource() :
 		row(0.0),
 		col(0.0),
 		range(0.0),
-		temperature(0.0)
+		temperature(0.0),
+		firstKeyframe(0),
+		numKeyframes(0)
 	{
 	}
 };
 
+enum SolverType {
+	GAUSS_SEIDEL,
+	MULTIGRID,
+	JACOBI
+};
+
+// Halo edges whose messages are compressed in the MPI builds
+enum HaloCompression {
+	COMPRESS_NONE,
+	COMPRESS_OFF_NODE,
+	COMPRESS_ALL
+};
+
+// Values the grid starts from
+enum GuessType {
+	GUESS_NONE,
+	GUESS_FIELD,
+	GUESS_COARSE
+};
+
 struct ProcessLayout
 {
 	int x;
@@ -39,6 +75,7 @@ struct ProcessLayout
 
 	ProcessLayout(int a, int b) {x = a; y = b;}
 	ProcessLayout(const ProcessLayout &pl) {x = pl.x; y = pl.y;}
+	ProcessLayout &operator=(const ProcessLayout &pl) = default;
 };
 
 struct HeatConfiguration {
@@ -47,16 +84,47 @@ struct HeatConfiguration {
 	int cols;
 	int rowBlocks;
 	int colBlocks;
+	int rowOffset;
+	int colOffset;
+	int lastBlockRows;
+	int lastBlockCols;
+	std::vector<int> rowSplit;
+	std::vector<int> colSplit;
 	block_t *matrix;
-	col_t *halos_row[2];
-	row_t *halos_col[2];
+	block_t *nextMatrix;
+	row_t *halos_row[2];
+	col_t *halos_col[2];
 	bool isSingleProcess;
 	int numHeatSources;
 	HeatSource *heatSources;
+	std::vector<HeatKeyframe> keyframes;
+	int step;
 	std::string confFileName;
 	std::string imageFileName;
+	std::string ensembleFileName;
 	bool generateImage;
+	std::string fieldFileName;
+	bool generateField;
+	bool compressField;
 	ProcessLayout processLayout;
+	double omega;
+	SolverType solver;
+	int mgCycle;
+	bool activeBlocks;
+	double activeTolerance;
+	double *blockChange;
+	bool paddedBlocks;
+	paddedBlock_t *paddedMatrix;
+	bool paddedCurrent;
+	int superBlocks;
+	int rebalanceInterval;
+	double *blockTime;
+	HaloCompression haloCompression;
+	std::string traceFileName;
+	bool measureEnergy;
+	GuessType initialGuess;
+	std::string guessFileName;
+	int guessCoarsening;
 	
 	HeatConfiguration() :
 		timesteps(0),
@@ -64,28 +132,64 @@ struct HeatConfiguration {
 		cols(0),
 		rowBlocks(0),
 		colBlocks(0),
+		rowOffset(0),
+		colOffset(0),
+		lastBlockRows(BSX),
+		lastBlockCols(BSY),
 		matrix(nullptr),
+		nextMatrix(nullptr),
 		halos_row{nullptr},
 		halos_col{nullptr},
 		isSingleProcess (true),
 		numHeatSources(0),
 		heatSources(nullptr),
+		step(0),
 		confFileName("heat.conf"),
 		imageFileName("heat.ppm"),
+		ensembleFileName(""),
 		generateImage(false),
-		processLayout{1,1}
+		fieldFileName("heat.fld"),
+		generateField(false),
+		compressField(false),
+		processLayout{1,1},
+		omega(1.0),
+		solver(GAUSS_SEIDEL),
+		mgCycle(1),
+		activeBlocks(false),
+		activeTolerance(0.0),
+		blockChange(nullptr),
+		paddedBlocks(false),
+		paddedMatrix(nullptr),
+		paddedCurrent(false),
+		superBlocks(1),
+		rebalanceInterval(0),
+		blockTime(nullptr),
+		haloCompression(COMPRESS_NONE),
+		traceFileName(""),
+		measureEnergy(false),
+		initialGuess(GUESS_NONE),
+		guessFileName(""),
+		guessCoarsening(8)
 	{
 	}
 };
 
 int initialize(HeatConfiguration &conf, int rowBlocks, int colBlocks , ProcessLayout r = ProcessLayout (0,0));
 int finalize(HeatConfiguration &conf);
-int writeImage(std::string fileName, block_t *matrix, int rowBlocks, int colBlocks);
+int writeImage(std::string fileName, block_t *matrix, int rowBlocks, int colBlocks, int rows, int cols);
 HeatConfiguration readConfiguration(int argc, char **argv);
-void refineConfiguration(HeatConfiguration &conf, int rowValue, int colValue, bool isSingleProcess);
+void readParameters(int argc, char **argv, HeatConfiguration &conf);
+void readSourcesFile(HeatConfiguration &conf);
+void keepBoundarySources(HeatConfiguration &conf, int rowBlocks, int colBlocks, ProcessLayout r = ProcessLayout (0,0));
+void refineConfiguration(HeatConfiguration &conf, int rowParts, int colParts, bool isSingleProcess);
+void splitBlocks(int blocks, int parts, int part, int &count, int &offset);
+void decomposeConfiguration(HeatConfiguration &conf, ProcessLayout r, int &rowBlocks, int &colBlocks);
 void printConfiguration(const HeatConfiguration &conf);
 void initializeMatrix(const HeatConfiguration &conf, block_t *matrix, int rowBlocks, int colBlocks, ProcessLayout r = ProcessLayout (0,0));
 void initializeHalos(const HeatConfiguration &conf, block_t *matrix, int rowBlocks, int colBlocks, ProcessLayout r = ProcessLayout (0,0));
+void updateHalos(const HeatConfiguration &conf, int rowBlocks, int colBlocks, ProcessLayout r = ProcessLayout (0,0));
+HeatSource sourceAt(const HeatConfiguration &conf, int source, int step);
+void gridBoundary(const HeatConfiguration &conf, int step, std::vector<real_t> boundary[4]);
 double get_time();
 double solve(block_t *matrix, int rowBlocks, int colBlocks, HeatConfiguration &conf,  row_t ** halos_row = nullptr, col_t ** halos_col = nullptr,  ProcessLayout r = ProcessLayout (0,0));
 
@@ -0,0 +1,171 @@
+#ifndef JACOBI_HPP
+#define JACOBI_HPP
+
+#include <cstdint>
+
+#include "common/heat.hpp"
+#include "common/matrix.hpp"
+#include "common/trace.hpp"
+
+static_assert(BSY >= 2, "The Jacobi kernel needs at least two columns per block");
+
+// Built with STREAMING=1, the full blocks write the output grid of a Jacobi
+// step with non-temporal vector stores, so that it does not evict the input
+// grid. Each row is computed in chunks of one vector, which the compiler
+// keeps in a register, and every chunk that starts at an aligned address is
+// streamed; the cells before and after them are stored as usual.
+#if defined(HEAT_STREAMING_STORES) && defined(__SSE2__)
+#include <immintrin.h>
+#define HEAT_VECTOR_STREAMING
+
+#ifdef __AVX__
+const int StreamBytes = 32;
+#else
+const int StreamBytes = 16;
+#endif
+const int StreamWidth = StreamBytes / sizeof(real_t);
+
+inline void streamChunk(real_t *address, const real_t *chunk)
+{
+#ifdef __AVX__
+	if (sizeof(real_t) == sizeof(double)) _mm256_stream_pd((double *) address, _mm256_load_pd((const double *) chunk));
+	else                                  _mm256_stream_ps((float *) address, _mm256_load_ps((const float *) chunk));
+#else
+	if (sizeof(real_t) == sizeof(double)) _mm_stream_pd((double *) address, _mm_load_pd((const double *) chunk));
+	else                                  _mm_stream_ps((float *) address, _mm_load_ps((const float *) chunk));
+#endif
+}
+#endif
+
+// Order the streaming stores of a block before it is consumed elsewhere
+inline void streamFence()
+{
+#ifdef HEAT_VECTOR_STREAMING
+	_mm_sfence();
+#endif
+}
+
+// Update of a cell, over-relaxed by omega when Relaxed
+template <bool Relaxed>
+inline double relax(double current, double update, double omega)
+{
+	return Relaxed ? current + omega * (update - current) : update;
+}
+
+// Jacobi update of block (bx, by): reads only the source grid and the halos
+// and writes the target grid, so all blocks of a timestep are independent.
+// The first and last elements of each row are peeled off so that the inner
+// loop has no branches.
+template <bool Relaxed>
+inline void solveBlockJacobi(block_t *source, block_t *target, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, double omega)
+{
+	block_t &targetBlock = target[blockIndex(bx, by, nbx, nby)];
+	const block_t &centerBlock = source[blockIndex(bx, by, nbx, nby)];
+	const block_t *topBlock    = (bx == 0)     ? nullptr : &source[blockIndex(bx-1, by, nbx, nby)];
+	const block_t *leftBlock   = (by == 0)     ? nullptr : &source[blockIndex(bx, by-1, nbx, nby)];
+	const block_t *rightBlock  = (by == nby-1) ? nullptr : &source[blockIndex(bx, by+1, nbx, nby)];
+	const block_t *bottomBlock = (bx == nbx-1) ? nullptr : &source[blockIndex(bx+1, by, nbx, nby)];
+
+	const row_t &haloTop    = (bx == 0)    ? halo_row[top]   [by] : (*topBlock)[BSX-1];
+	const row_t &haloBottom = (bx == nbx-1)? halo_row[bottom][by] : (*bottomBlock)[0];
+
+	for (int x = 0; x < BSX; ++x) {
+
+		const row_t &topRow    = (x > 0)     ? centerBlock[x-1] : haloTop;
+		const row_t &bottomRow = (x < BSX-1) ? centerBlock[x+1] : haloBottom;
+		const row_t &centerRow = centerBlock[x];
+		row_t &targetRow = targetBlock[x];
+
+		const double halo_left_element  = (by == 0)     ? halo_col[left] [bx][x] : (*leftBlock)[x][BSY-1];
+		const double halo_right_element = (by == nby-1) ? halo_col[right][bx][x] : (*rightBlock)[x][0];
+
+		auto cell = [&](int y) {
+			double value = 0.25 * ((double) topRow[y] + bottomRow[y] + centerRow[y-1] + centerRow[y+1]);
+			return relax<Relaxed>(centerRow[y], value, omega);
+		};
+
+		targetRow[0] = relax<Relaxed>(centerRow[0],
+			0.25 * ((double) topRow[0] + bottomRow[0] + halo_left_element + centerRow[1]), omega);
+
+		int y = 1;
+#ifdef HEAT_VECTOR_STREAMING
+		for (; y < BSY-1 && ((uintptr_t) &targetRow[y]) % StreamBytes != 0; ++y) {
+			targetRow[y] = cell(y);
+		}
+		for (; y + StreamWidth <= BSY-1; y += StreamWidth) {
+			alignas(StreamBytes) real_t chunk[StreamWidth];
+			for (int k = 0; k < StreamWidth; ++k) {
+				chunk[k] = cell(y + k);
+			}
+			streamChunk(&targetRow[y], chunk);
+		}
+#endif
+		for (; y < BSY-1; ++y) {
+			targetRow[y] = cell(y);
+		}
+
+		targetRow[BSY-1] = relax<Relaxed>(centerRow[BSY-1],
+			0.25 * ((double) topRow[BSY-1] + bottomRow[BSY-1] + centerRow[BSY-2] + halo_right_element), omega);
+	}
+
+	streamFence();
+}
+
+// Jacobi update of a partial block at the bottom or right edge of the grid,
+// which holds only nx rows and ny columns of the domain
+template <bool Relaxed>
+inline void solveBlockJacobiPartial(block_t *source, block_t *target, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, int nx, int ny, double omega)
+{
+	block_t &targetBlock = target[blockIndex(bx, by, nbx, nby)];
+	const block_t &centerBlock = source[blockIndex(bx, by, nbx, nby)];
+	const block_t *topBlock    = (bx == 0)     ? nullptr : &source[blockIndex(bx-1, by, nbx, nby)];
+	const block_t *leftBlock   = (by == 0)     ? nullptr : &source[blockIndex(bx, by-1, nbx, nby)];
+	const block_t *rightBlock  = (by == nby-1) ? nullptr : &source[blockIndex(bx, by+1, nbx, nby)];
+	const block_t *bottomBlock = (bx == nbx-1) ? nullptr : &source[blockIndex(bx+1, by, nbx, nby)];
+
+	const row_t &haloTop    = (bx == 0)    ? halo_row[top]   [by] : (*topBlock)[BSX-1];
+	const row_t &haloBottom = (bx == nbx-1)? halo_row[bottom][by] : (*bottomBlock)[0];
+
+	for (int x = 0; x < nx; ++x) {
+
+		const row_t &topRow    = (x > 0)    ? centerBlock[x-1] : haloTop;
+		const row_t &bottomRow = (x < nx-1) ? centerBlock[x+1] : haloBottom;
+		const row_t &centerRow = centerBlock[x];
+
+		const double halo_left_element  = (by == 0)     ? halo_col[left] [bx][x] : (*leftBlock)[x][BSY-1];
+		const double halo_right_element = (by == nby-1) ? halo_col[right][bx][x] : (*rightBlock)[x][0];
+
+		for (int y = 0; y < ny; ++y) {
+			double leftElement  = (y > 0)    ? centerRow[y-1] : halo_left_element;
+			double rightElement = (y < ny-1) ? centerRow[y+1] : halo_right_element;
+			double value = 0.25 * ((double) topRow[y] + bottomRow[y] + leftElement + rightElement);
+			targetBlock[x][y] = relax<Relaxed>(centerRow[y], value, omega);
+		}
+	}
+}
+
+inline void jacobiBlock(block_t *source, block_t *target, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, const HeatConfiguration &conf, int step)
+{
+	const int nx = (bx == nbx-1) ? conf.lastBlockRows : BSX;
+	const int ny = (by == nby-1) ? conf.lastBlockCols : BSY;
+	const double start = (conf.blockTime != nullptr) ? get_time() : 0.0;
+	const double traced = traceBegin();
+
+	// Plain Jacobi (omega 1) skips the blend of the over-relaxation
+	const bool full = (nx == BSX && ny == BSY);
+	if (conf.omega == 1.0) {
+		if (full) solveBlockJacobi<false>(source, target, halo_row, halo_col, nbx, nby, bx, by, conf.omega);
+		else      solveBlockJacobiPartial<false>(source, target, halo_row, halo_col, nbx, nby, bx, by, nx, ny, conf.omega);
+	} else {
+		if (full) solveBlockJacobi<true>(source, target, halo_row, halo_col, nbx, nby, bx, by, conf.omega);
+		else      solveBlockJacobiPartial<true>(source, target, halo_row, halo_col, nbx, nby, bx, by, nx, ny, conf.omega);
+	}
+
+	traceEnd(TRACE_BLOCK, bx, by, step, traced);
+
+	if (conf.blockTime != nullptr) {
+		conf.blockTime[blockIndex(bx, by, nbx, nby)] += get_time() - start;
+	}
+}
+
+#endif // JACOBI_HPP
@@ -9,39 +9,68 @@
 #define BSY BSX
 #endif
 
+#include <cstring>
+
+#include "common/blockorder.hpp"
+
 #define left 0
 #define right 1
 #define top 0
 #define bottom 1
 
+// Storage precision of the grid and halos (build with PREC=float to halve
+// the memory traffic and message sizes). The stencil is always accumulated
+// in double precision.
+#ifndef HEAT_REAL
+#define HEAT_REAL double
+#endif
+
+// MPI datatype matching the storage precision
+#define HEAT_MPI_REAL (sizeof(real_t) == sizeof(float) ? MPI_FLOAT : MPI_DOUBLE)
+
 // Definition of types
-typedef double row_t[BSY];
-typedef double col_t[BSX];
+typedef HEAT_REAL real_t;
+typedef real_t row_t[BSY];
+typedef real_t col_t[BSX];
 typedef row_t block_t[BSX];
 
+// Block with a one-cell ghost frame: its cells are stored at [1..BSX][1..BSY]
+// and the frame holds copies of the neighbouring cells, so that a sweep over
+// the block needs no edge cases
+typedef real_t paddedRow_t[BSY+2];
+typedef paddedRow_t paddedBlock_t[BSX+2];
+
 // Useful functions for matrices
 template <typename Func>
-inline void traverseRow(block_t *matrix, int numColBlocks, int row, int startCol, int endCol, Func func)
+inline void traverseRow(block_t *matrix, int numRowBlocks, int numColBlocks, int row, int startCol, int endCol, Func func)
 {
 	int rowBlock = row / BSX;
-	for (int col = startCol; col < endCol; ++col) {
+	for (int col = startCol; col < endCol; ) {
 		int colBlock = col / BSY;
-		block_t &block = matrix[rowBlock * numColBlocks + colBlock];
-		func(row, col, block[row % BSX][col % BSY]);
+		int blockEnd = std::min(endCol, (colBlock + 1) * BSY);
+		block_t &block = matrix[blockIndex(rowBlock, colBlock, numRowBlocks, numColBlocks)];
+		for (; col < blockEnd; ++col) {
+			func(row, col, block[row % BSX][col % BSY]);
+		}
 	}
 }
 
+// Traverse the first numRows x numCols elements (the last blocks of the grid
+// may be partially used)
 template <typename Func>
-inline void traverseByRows(block_t *matrix, int rowBlocks, int colBlocks, Func func)
+inline void traverseByRows(block_t *matrix, int rowBlocks, int colBlocks, int numRows, int numCols, Func func)
 {
-	int numRows = rowBlocks * BSX;
-	int numCols = colBlocks * BSY;
-
 	for (int x = 0; x < numRows; ++x) {
-		traverseRow(matrix, colBlocks, x, 0, numCols, func);
+		traverseRow(matrix, rowBlocks, colBlocks, x, 0, numCols, func);
 	}
 }
 
+template <typename Func>
+inline void traverseByRows(block_t *matrix, int rowBlocks, int colBlocks, Func func)
+{
+	traverseByRows(matrix, rowBlocks, colBlocks, rowBlocks * BSX, colBlocks * BSY, func);
+}
+
 
 template <typename Func>
 inline void copyByRows(block_t *source, block_t * target, int rowBlocks, int colBlocks, Func func)
@@ -53,8 +82,55 @@ inline void copyByRows(block_t *source, block_t * target, int rowBlocks, int col
 }
 
 
+// Copy the blocks of a grid into the padded blocks at the same storage
+// indices, or back
+inline void padBlocks(const block_t *matrix, paddedBlock_t *padded, int numBlocks)
+{
+	for (int b = 0; b < numBlocks; ++b) {
+		for (int x = 0; x < BSX; ++x) {
+			memcpy(&padded[b][x+1][1], matrix[b][x], sizeof(row_t));
+		}
+	}
+}
+
+inline void unpadBlocks(const paddedBlock_t *padded, block_t *matrix, int numBlocks)
+{
+	for (int b = 0; b < numBlocks; ++b) {
+		for (int x = 0; x < BSX; ++x) {
+			memcpy(matrix[b][x], &padded[b][x+1][1], sizeof(row_t));
+		}
+	}
+}
+
+// Refresh the ghost frame of padded block (bx, by), which uses rows x cols of
+// its cells, from the current neighbouring blocks or from the halos at the
+// grid edges. The corners are not used by the 5-point stencil.
+inline void refreshGhosts(paddedBlock_t *padded, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, int rows, int cols)
+{
+	paddedBlock_t &block = padded[blockIndex(bx, by, nbx, nby)];
+
+	const real_t *topRow    = (bx == 0)     ? halo_row[top][by]    : &padded[blockIndex(bx-1, by, nbx, nby)][BSX][1];
+	const real_t *bottomRow = (bx == nbx-1) ? halo_row[bottom][by] : &padded[blockIndex(bx+1, by, nbx, nby)][1][1];
+	memcpy(&block[0][1], topRow, cols * sizeof(real_t));
+	memcpy(&block[rows+1][1], bottomRow, cols * sizeof(real_t));
+
+	if (by == 0) {
+		for (int x = 0; x < rows; ++x) block[x+1][0] = halo_col[left][bx][x];
+	} else {
+		const paddedBlock_t &leftBlock = padded[blockIndex(bx, by-1, nbx, nby)];
+		for (int x = 0; x < rows; ++x) block[x+1][0] = leftBlock[x+1][BSY];
+	}
+
+	if (by == nby-1) {
+		for (int x = 0; x < rows; ++x) block[x+1][cols+1] = halo_col[right][bx][x];
+	} else {
+		const paddedBlock_t &rightBlock = padded[blockIndex(bx, by+1, nbx, nby)];
+		for (int x = 0; x < rows; ++x) block[x+1][cols+1] = rightBlock[x+1][1];
+	}
+}
+
 template <typename Func>
-inline void traverseRowHalo(col_t * row,int r, int startCol, int endCol, Func func)
+inline void traverseRowHalo(row_t * row,int r, int startCol, int endCol, Func func)
 {;
 	for (int col = startCol; col < endCol; ++col) {
 		func(r, col, row[col / BSY][col % BSY]);
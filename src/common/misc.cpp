@@ -1,22 +1,30 @@
+#include <algorithm>
 #include <cassert>
 #include <cfloat>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <getopt.h>
 #include <iostream>
 #include <sys/time.h>
+#include <type_traits>
 
 #include "common/matrix.hpp"
 #include "common/heat.hpp"
+#include "common/activity.hpp"
+#include "common/warmstart.hpp"
 
 int initialize(HeatConfiguration &conf, int rowBlocks, int colBlocks, ProcessLayout rank2D)
 {
 	conf.matrix = (block_t *) malloc(rowBlocks * colBlocks * sizeof(block_t));
 
-	conf.halos_row[top]    = (row_t *) calloc(colBlocks, sizeof(row_t));
-	conf.halos_row[bottom] = (row_t *) calloc(colBlocks, sizeof(row_t));
-	conf.halos_col[left]   = (col_t *) calloc(rowBlocks, sizeof(col_t));
-	conf.halos_col[right]  = (col_t *) calloc(rowBlocks, sizeof(col_t));
+	// HaloDepth rows and columns of halos, for the stencils that read them
+	// from other ranks
+	conf.halos_row[top]    = (row_t *) calloc(HaloDepth * colBlocks, sizeof(row_t));
+	conf.halos_row[bottom] = (row_t *) calloc(HaloDepth * colBlocks, sizeof(row_t));
+	conf.halos_col[left]   = (col_t *) calloc(HaloDepth * rowBlocks, sizeof(col_t));
+	conf.halos_col[right]  = (col_t *) calloc(HaloDepth * rowBlocks, sizeof(col_t));
 
 	if ( conf.matrix == NULL \
 			|| conf.halos_row[top] == NULL \
@@ -28,7 +36,51 @@ int initialize(HeatConfiguration &conf, int rowBlocks, int colBlocks, ProcessLay
 	}
 
 	initializeMatrix(conf, conf.matrix, rowBlocks, colBlocks, rank2D);
+	if (conf.initialGuess != GUESS_NONE) {
+		initializeGuess(conf, conf.matrix, rowBlocks, colBlocks);
+	}
+
+	// Jacobi iterations alternate between two grids
+	if (conf.solver == JACOBI) {
+		conf.nextMatrix = (block_t *) malloc(rowBlocks * colBlocks * sizeof(block_t));
+		if (conf.nextMatrix == NULL) {
+			fprintf(stderr, "Error: Memory cannot be allocated!\n");
+			exit(1);
+		}
+		initializeMatrix(conf, conf.nextMatrix, rowBlocks, colBlocks, rank2D);
+	}
+
 	initializeHalos(conf, conf.matrix, rowBlocks, colBlocks, rank2D);
+
+	// Track the blocks that can still change in the Gauss-Seidel sweeps
+	if (conf.activeBlocks && conf.solver == GAUSS_SEIDEL) {
+		conf.blockChange = (double *) malloc(rowBlocks * colBlocks * sizeof(double));
+		if (conf.blockChange == NULL) {
+			fprintf(stderr, "Error: Memory cannot be allocated!\n");
+			exit(1);
+		}
+		initializeActivity(conf, conf.blockChange, rowBlocks, colBlocks, rank2D);
+	}
+
+	// Padded copy of the grid for the Gauss-Seidel sweeps, kept across solves
+	// and filled by the first one
+	if (conf.paddedBlocks && conf.solver == GAUSS_SEIDEL) {
+		conf.paddedMatrix = (paddedBlock_t *) malloc(rowBlocks * colBlocks * sizeof(paddedBlock_t));
+		if (conf.paddedMatrix == NULL) {
+			fprintf(stderr, "Error: Memory cannot be allocated!\n");
+			exit(1);
+		}
+		conf.paddedCurrent = false;
+	}
+
+	// Time spent updating each block, which drives the load balancing
+	if (conf.rebalanceInterval > 0) {
+		conf.blockTime = (double *) calloc(rowBlocks * colBlocks, sizeof(double));
+		if (conf.blockTime == NULL) {
+			fprintf(stderr, "Error: Memory cannot be allocated!\n");
+			exit(1);
+		}
+	}
 	return 0;
 }
 
@@ -38,6 +90,18 @@ int finalize(HeatConfiguration &conf)
 	free(conf.matrix);
 	conf.matrix = nullptr;
 
+	free(conf.nextMatrix);
+	conf.nextMatrix = nullptr;
+
+	free(conf.blockChange);
+	conf.blockChange = nullptr;
+
+	free(conf.paddedMatrix);
+	conf.paddedMatrix = nullptr;
+
+	free(conf.blockTime);
+	conf.blockTime = nullptr;
+
 	for(int i = 0; i < 2; ++i){
 		assert(conf.halos_row[i] != nullptr);
 		assert(conf.halos_col[i] != nullptr);
@@ -50,7 +114,7 @@ int finalize(HeatConfiguration &conf)
 	return 0;
 }
 
-int writeImage(std::string imageFileName, block_t *matrix, int rowBlocks, int colBlocks)
+int writeImage(std::string imageFileName, block_t *matrix, int rowBlocks, int colBlocks, int rows, int cols)
 {
 	// RGB table
 	unsigned int r[1024], g[1024], b[1024];
@@ -80,7 +144,7 @@ int writeImage(std::string imageFileName, block_t *matrix, int rowBlocks, int co
 	// Find minimum and maximum
 	double min = DBL_MAX;
 	double max = -DBL_MAX;
-	traverseByRows(matrix, rowBlocks, colBlocks,
+	traverseByRows(matrix, rowBlocks, colBlocks, rows, cols,
 		[&](int x, int y, double value) {
 			if (value > max)
 				max = value;
@@ -89,8 +153,6 @@ int writeImage(std::string imageFileName, block_t *matrix, int rowBlocks, int co
 		}
 	);
 	
-	int rows = rowBlocks * BSX;
-	int cols = colBlocks * BSY;
 	std::ofstream file;
 	file.open(imageFileName);
 	
@@ -99,7 +161,7 @@ int writeImage(std::string imageFileName, block_t *matrix, int rowBlocks, int co
 	file << 255 << std::endl;
 	
 
-	traverseByRows(matrix, rowBlocks, colBlocks,
+	traverseByRows(matrix, rowBlocks, colBlocks, rows, cols,
 		[&](int x, int y, double value) {
 			int k = 0;
 			if (max - min != 0) {
@@ -125,7 +187,35 @@ void printUsage(int argc, char **argv)
 	fprintf(stdout, "  -t, --timesteps=TIMESTEPS\tuse TIMESTEPS as the number of timesteps\n\n");
 	fprintf(stdout, "Optional parameters:\n");
 	fprintf(stdout, "  -f, --sources-file=NAME\tget the heat sources from the NAME configuration file (default: heat.conf)\n");
+	fprintf(stdout, "  -e, --ensemble=LIST\t\tsolve one grid for each heat sources file listed in LIST, all with the same size\n");
+	fprintf(stdout, "                   \t\tand options, concurrently in one process (images and fields are saved as NAME.CASE.ppm and NAME.CASE.fld)\n");
 	fprintf(stdout, "  -o, --output[=NAME]\t\tsave the computed matrix to a PPM file, being 'heat.ppm' the default name (disabled by default)\n");
+	fprintf(stdout, "  -g, --initial-guess=GUESS\tstart from GUESS instead of zero: the field file of a previous solve (-F),\n");
+	fprintf(stdout, "                   \t\tinterpolated if its size differs, or 'coarse[:F]' for a solve of the grid\n");
+	fprintf(stdout, "                   \t\tcoarsened F times (default: 8)\n");
+	fprintf(stdout, "  -F, --field[=NAME]\t\tsave the computed matrix at full precision to a field file of independently\n");
+	fprintf(stdout, "                   \t\treadable blocks, being 'heat.fld' the default name (disabled by default)\n");
+	fprintf(stdout, "  -Z, --compress-field\t\tcode every block of the field file without loss\n");
+	fprintf(stdout, "  -w, --omega=OMEGA\t\tuse successive over-relaxation with factor OMEGA in (0, 2), or 'auto' to derive\n");
+	fprintf(stdout, "                   \t\tthe optimal factor from the grid size (default: 1, plain Gauss-Seidel)\n");
+	fprintf(stdout, "  -m, --solver=NAME\t\tuse 'gs' for Gauss-Seidel sweeps, 'jacobi' for Jacobi sweeps on two grids, or 'mg'\n");
+	fprintf(stdout, "                   \t\tfor multigrid cycles smoothed by the sweeps, one cycle per timestep\n");
+	fprintf(stdout, "                   \t\t(default: gs, mg only in single-process builds)\n");
+	fprintf(stdout, "  -C, --mg-cycle=TYPE\t\tuse 'v' or 'w' multigrid cycles (default: v)\n");
+	fprintf(stdout, "  -a, --active-blocks[=TOL]\tskip the Gauss-Seidel update of blocks whose own and neighbouring last updates\n");
+	fprintf(stdout, "                   \t\tchanged them by at most TOL (sum of squares, default: 0, exact)\n");
+	fprintf(stdout, "  -p, --padded\t\t\trun the Gauss-Seidel sweeps on a copy of the grid whose blocks store a ghost\n");
+	fprintf(stdout, "                   \t\tframe of neighbouring cells (single-process builds only)\n");
+	fprintf(stdout, "  -k, --super-blocks=K\t\tgroup the Gauss-Seidel block tasks into outer tasks of KxK blocks with weak\n");
+	fprintf(stdout, "                   \t\tdependencies (default: 1, no grouping, OmpSs task versions only)\n");
+	fprintf(stdout, "  -b, --rebalance=STEPS\t\tmove block rows and columns between neighbouring ranks every STEPS timesteps\n");
+	fprintf(stdout, "                   \t\tto balance their measured update times (default: 0, disabled, MPI builds only)\n");
+	fprintf(stdout, "  -z, --compress-halos[=all]\tcompress the halos exchanged with ranks on other nodes, or with all ranks,\n");
+	fprintf(stdout, "                   \t\twithout loss (MPI builds only)\n");
+	fprintf(stdout, "  -T, --trace=NAME\t\trecord when each block update and halo transfer ran on which thread and rank,\n");
+	fprintf(stdout, "                   \t\tand write them to NAME.json (Chrome trace) and NAME.csv\n");
+	fprintf(stdout, "  -E, --energy\t\t\tmeasure the package and DRAM energy of the solve with the RAPL counters and\n");
+	fprintf(stdout, "                   \t\treport it with the average power and the cell updates per joule\n");
 	fprintf(stdout, "  -h, --help\t\t\tdisplay this help and exit\n\n");
 }
 
@@ -137,14 +227,28 @@ void readParameters(int argc, char **argv, HeatConfiguration &conf)
 		{"cols",         required_argument,  0, 'c'},
 		{"timesteps",    required_argument,  0, 't'},
 		{"sources-file", required_argument,  0, 'f'},
+		{"ensemble",     required_argument,  0, 'e'},
 		{"output",       optional_argument,  0, 'o'},
+		{"initial-guess", required_argument, 0, 'g'},
+		{"field",        optional_argument,  0, 'F'},
+		{"compress-field", no_argument,      0, 'Z'},
+		{"omega",        required_argument,  0, 'w'},
+		{"solver",       required_argument,  0, 'm'},
+		{"mg-cycle",     required_argument,  0, 'C'},
+		{"active-blocks", optional_argument, 0, 'a'},
+		{"padded",       no_argument,        0, 'p'},
+		{"super-blocks", required_argument,  0, 'k'},
+		{"rebalance",    required_argument,  0, 'b'},
+		{"compress-halos", optional_argument, 0, 'z'},
+		{"trace",        required_argument,  0, 'T'},
+		{"energy",       no_argument,        0, 'E'},
 		{"help",         no_argument,        0, 'h'},
 		{0, 0, 0, 0}
 	};
 
 	int c;
 	int index;
-	while ((c = getopt_long(argc, argv, "ho::fs:r:c:t:", long_options, &index)) != -1) {
+	while ((c = getopt_long(argc, argv, "ho::g:F::Zf:e:s:r:c:t:w:m:C:a::pk:b:z::T:E", long_options, &index)) != -1) {
 		switch (c) {
 			case 'h':
 				printUsage(argc, argv);
@@ -152,12 +256,39 @@ void readParameters(int argc, char **argv, HeatConfiguration &conf)
 			case 'f':
 				conf.confFileName = optarg;
 				break;
+			case 'e':
+				conf.ensembleFileName = optarg;
+				break;
 			case 'o':
 				conf.generateImage = true;
 				if (optarg) {
 					conf.imageFileName = optarg;
 				}
 				break;
+			case 'g':
+				if (std::string(optarg).compare(0, 6, "coarse") == 0 && (optarg[6] == '\0' || optarg[6] == ':')) {
+					conf.initialGuess = GUESS_COARSE;
+					if (optarg[6] == ':') {
+						conf.guessCoarsening = atoi(optarg + 7);
+					}
+					if (conf.guessCoarsening < 2) {
+						fprintf(stderr, "Error: The coarsening of the initial guess must be at least 2!\n");
+						exit(1);
+					}
+				} else {
+					conf.initialGuess = GUESS_FIELD;
+					conf.guessFileName = optarg;
+				}
+				break;
+			case 'F':
+				conf.generateField = true;
+				if (optarg) {
+					conf.fieldFileName = optarg;
+				}
+				break;
+			case 'Z':
+				conf.compressField = true;
+				break;
 			case 's':
 				conf.rows = atoi(optarg);
 				conf.cols = atoi(optarg);
@@ -171,6 +302,78 @@ void readParameters(int argc, char **argv, HeatConfiguration &conf)
 			case 't':
 				conf.timesteps = atoi(optarg);
 				break;
+			case 'w':
+				// Zero requests the optimal factor, computed once the grid size is final
+				conf.omega = (std::string(optarg) == "auto") ? 0.0 : atof(optarg);
+				if (conf.omega < 0.0 || conf.omega >= 2.0 || (conf.omega == 0.0 && std::string(optarg) != "auto")) {
+					fprintf(stderr, "Error: The relaxation factor must be in (0, 2)!\n");
+					exit(1);
+				}
+				break;
+			case 'm':
+				if (std::string(optarg) == "gs") {
+					conf.solver = GAUSS_SEIDEL;
+				} else if (std::string(optarg) == "mg") {
+					conf.solver = MULTIGRID;
+				} else if (std::string(optarg) == "jacobi") {
+					conf.solver = JACOBI;
+				} else {
+					fprintf(stderr, "Error: Unknown solver %s!\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'C':
+				if (std::string(optarg) == "v") {
+					conf.mgCycle = 1;
+				} else if (std::string(optarg) == "w") {
+					conf.mgCycle = 2;
+				} else {
+					fprintf(stderr, "Error: Unknown multigrid cycle %s!\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'a':
+				conf.activeBlocks = true;
+				if (optarg) {
+					conf.activeTolerance = atof(optarg);
+				}
+				if (conf.activeTolerance < 0.0) {
+					fprintf(stderr, "Error: The active-block tolerance must not be negative!\n");
+					exit(1);
+				}
+				break;
+			case 'p':
+				conf.paddedBlocks = true;
+				break;
+			case 'k':
+				conf.superBlocks = atoi(optarg);
+				if (conf.superBlocks < 1) {
+					fprintf(stderr, "Error: The super-block size must be positive!\n");
+					exit(1);
+				}
+				break;
+			case 'b':
+				conf.rebalanceInterval = atoi(optarg);
+				if (conf.rebalanceInterval < 0) {
+					fprintf(stderr, "Error: The rebalance interval must not be negative!\n");
+					exit(1);
+				}
+				break;
+			case 'z':
+				conf.haloCompression = COMPRESS_OFF_NODE;
+				if (optarg && std::string(optarg) == "all") {
+					conf.haloCompression = COMPRESS_ALL;
+				} else if (optarg) {
+					fprintf(stderr, "Error: Unknown halo compression %s!\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'T':
+				conf.traceFileName = optarg;
+				break;
+			case 'E':
+				conf.measureEnergy = true;
+				break;
 			case '?':
 				exit(1);
 			default:
@@ -182,74 +385,207 @@ void readParameters(int argc, char **argv, HeatConfiguration &conf)
 		printUsage(argc, argv);
 		exit(1);
 	}
+
+	// The Jacobi, multigrid and padded sweeps keep their 5-point kernels
+	if (!std::is_same<Stencil, FivePointStencil>::value && (conf.solver != GAUSS_SEIDEL || conf.paddedBlocks)) {
+		fprintf(stderr, "Error: The %s stencil is only available in the Gauss-Seidel sweeps!\n", Stencil::name());
+		exit(1);
+	}
 }
 
-HeatConfiguration readConfiguration(int argc, char **argv)
+// Binary sources files start with this tag, followed by the int32 values
+// layout.x, layout.y, numHeatSources and numKeyframes, the HeatSource records
+// and the HeatKeyframe records (see scripts/pack-sources.py)
+static const char SourcesTag[8] = {'H', 'E', 'A', 'T', 'S', 'R', 'C', '1'};
+
+static void sourcesFileError()
 {
-	// Default configuration
-	HeatConfiguration conf;
-	
-	// Read the execution parameters
-	readParameters(argc, argv, conf);
-	
-	std::string line;
-	std::ifstream file(conf.confFileName);
-	if (!file.is_open()) {
-		fprintf(stderr, "Error: Configuration file %s not found!\n", conf.confFileName.c_str());
-		exit(1);
+	fprintf(stderr, "Error: Configuration file not correct!\n");
+	exit(1);
+}
+
+// Next line of a text buffer, terminated in place; nullptr at the end
+static char *nextLine(char *&cursor)
+{
+	if (cursor == nullptr) return nullptr;
+	char *line = cursor;
+	char *end = strchr(cursor, '\n');
+	if (end != nullptr) {
+		*end = '\0';
+		cursor = end + 1;
+	} else {
+		cursor = nullptr;
 	}
-	
-	std::getline(file, line);
-	int n = std::sscanf(line.c_str(), "%d %d", &(conf.processLayout.x),&(conf.processLayout.y) );
-	if (n != 2) {
-			fprintf(stderr, "Error: Configuration file not correct!\n");
+	return line;
+}
+
+static int parseInt(char *&p)
+{
+	char *end;
+	long value = strtol(p, &end, 10);
+	if (end == p) sourcesFileError();
+	p = end;
+	return (int) value;
+}
+
+static float parseFloat(char *&p)
+{
+	char *end;
+	float value = strtof(p, &end);
+	if (end == p) sourcesFileError();
+	p = end;
+	return value;
+}
+
+static void checkKeyframes(const HeatConfiguration &conf, const HeatSource &src)
+{
+	for (int k = 0; k < src.numKeyframes; ++k) {
+		int previous = (k > 0) ? conf.keyframes[src.firstKeyframe + k - 1].step : 0;
+		if (conf.keyframes[src.firstKeyframe + k].step <= previous) {
+			fprintf(stderr, "Error: The keyframes of a heat source must have increasing steps after 0!\n");
 			exit(1);
+		}
 	}
+}
 
-	std::getline(file, line);
-	n = std::sscanf(line.c_str(), "%d", &(conf.numHeatSources));
-	if (n != 1) {
-		fprintf(stderr, "Error: Configuration file not correct!\n");
-		exit(1);
+static void readTextSources(HeatConfiguration &conf, char *cursor)
+{
+	char *line = nextLine(cursor);
+	if (line == nullptr) sourcesFileError();
+	conf.processLayout.x = parseInt(line);
+	conf.processLayout.y = parseInt(line);
+
+	line = nextLine(cursor);
+	if (line == nullptr) sourcesFileError();
+	conf.numHeatSources = parseInt(line);
+	if (conf.numHeatSources < 0) sourcesFileError();
+
+	conf.heatSources = (HeatSource *) malloc(sizeof(HeatSource) * std::max(conf.numHeatSources, 1));
+	assert(conf.heatSources != nullptr);
+
+	for (int i = 0; i < conf.numHeatSources; i++) {
+		char *p = nextLine(cursor);
+		if (p == nullptr) sourcesFileError();
+
+		HeatSource &src = conf.heatSources[i];
+		src.row = parseFloat(p);
+		src.col = parseFloat(p);
+		src.range = parseFloat(p);
+		src.temperature = parseFloat(p);
+
+		// Optional schedule: "at STEP row col range temperature" keyframes
+		src.firstKeyframe = conf.keyframes.size();
+		src.numKeyframes = 0;
+		while (true) {
+			p += strspn(p, " \t\r");
+			if (strncmp(p, "at", 2) != 0 || !isspace((unsigned char) p[2])) break;
+			p += 2;
+
+			HeatKeyframe key;
+			key.step = parseInt(p);
+			key.row = parseFloat(p);
+			key.col = parseFloat(p);
+			key.range = parseFloat(p);
+			key.temperature = parseFloat(p);
+			conf.keyframes.push_back(key);
+			src.numKeyframes++;
+		}
+		checkKeyframes(conf, src);
+
+		// Anything else must be a comment
+		if (*p != '\0' && *p != '#') sourcesFileError();
 	}
-	
-	conf.heatSources = (HeatSource *) malloc(sizeof(HeatSource) * conf.numHeatSources);
+}
+
+static void readBinarySources(HeatConfiguration &conf, const char *data, size_t size)
+{
+	int32_t header[4];
+	if (size < sizeof(SourcesTag) + sizeof(header)) sourcesFileError();
+	memcpy(header, data + sizeof(SourcesTag), sizeof(header));
+
+	conf.processLayout.x = header[0];
+	conf.processLayout.y = header[1];
+	conf.numHeatSources = header[2];
+	const int numKeyframes = header[3];
+	if (conf.numHeatSources < 0 || numKeyframes < 0) sourcesFileError();
+
+	const size_t sourcesBytes = (size_t) conf.numHeatSources * sizeof(HeatSource);
+	const size_t keyframesBytes = (size_t) numKeyframes * sizeof(HeatKeyframe);
+	const char *p = data + sizeof(SourcesTag) + sizeof(header);
+	if (size != sizeof(SourcesTag) + sizeof(header) + sourcesBytes + keyframesBytes) sourcesFileError();
+
+	conf.heatSources = (HeatSource *) malloc(std::max(sourcesBytes, sizeof(HeatSource)));
 	assert(conf.heatSources != nullptr);
-	
+	memcpy(conf.heatSources, p, sourcesBytes);
+	conf.keyframes.resize(numKeyframes);
+	memcpy(conf.keyframes.data(), p + sourcesBytes, keyframesBytes);
+
 	for (int i = 0; i < conf.numHeatSources; i++) {
-		std::getline(file, line);
-		n = std::sscanf(line.c_str(), "%f %f %f %f",
-			&(conf.heatSources[i].row),
-			&(conf.heatSources[i].col),
-			&(conf.heatSources[i].range),
-			&(conf.heatSources[i].temperature));
-		
-		if (n != 4) {
-			fprintf(stderr, "Error: Configuration file not correct!\n");
-			exit(1);
+		const HeatSource &src = conf.heatSources[i];
+		if (src.numKeyframes < 0 || src.firstKeyframe < 0 || src.firstKeyframe + src.numKeyframes > numKeyframes) {
+			sourcesFileError();
 		}
+		checkKeyframes(conf, src);
 	}
+}
+
+// Read the process layout and the heat sources from conf.confFileName. The
+// whole file is read at once and parsed in memory.
+void readSourcesFile(HeatConfiguration &conf)
+{
+	FILE *file = fopen(conf.confFileName.c_str(), "rb");
+	if (file == nullptr) {
+		fprintf(stderr, "Error: Configuration file %s not found!\n", conf.confFileName.c_str());
+		exit(1);
+	}
+
+	std::vector<char> data;
+	char chunk[65536];
+	size_t count;
+	while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+		data.insert(data.end(), chunk, chunk + count);
+	}
+	fclose(file);
+
+	conf.keyframes.clear();
+	if (data.size() >= sizeof(SourcesTag) && memcmp(data.data(), SourcesTag, sizeof(SourcesTag)) == 0) {
+		readBinarySources(conf, data.data(), data.size());
+	} else {
+		data.push_back('\0');
+		readTextSources(conf, data.data());
+	}
+}
+
+HeatConfiguration readConfiguration(int argc, char **argv)
+{
+	// Default configuration
+	HeatConfiguration conf;
 	
-	file.close();
+	// Read the execution parameters
+	readParameters(argc, argv, conf);
+
+	// In ensemble mode every case reads its own sources file
+	if (conf.ensembleFileName.empty()) {
+		readSourcesFile(conf);
+	}
 	
 	return conf;
 }
 
-void refineConfiguration(HeatConfiguration &conf, int rowValue, int colValue, bool isSingleProcess)
+void refineConfiguration(HeatConfiguration &conf, int rowParts, int colParts, bool isSingleProcess)
 {
 	assert(conf.rows > 0);
 	assert(conf.cols > 0);
 	assert(conf.timesteps > 0);
-	
-	if (conf.rows % rowValue) {
-		// Make the number of rows divisible by the value
-		fprintf(stderr, "Warning: The number of rows (%d) is not divisible by %d. Rounding it...\n", conf.rows, rowValue);
-		conf.rows = round(conf.rows, rowValue);
-	}
-	if (conf.cols % colValue) {
-		// Make the number of cols divisible by the value
-		fprintf(stderr, "Warning: The number of cols (%d) is not divisible by %d. Rounding it...\n", conf.cols, colValue);
-		conf.cols = round(conf.cols, colValue);
+
+	// The last block row and column of the grid may be partial
+	conf.rowBlocks = (conf.rows + BSX - 1) / BSX;
+	conf.colBlocks = (conf.cols + BSY - 1) / BSY;
+
+	if (conf.rowBlocks < rowParts || conf.colBlocks < colParts) {
+		fprintf(stderr, "Error: A %d x %d grid has fewer blocks than the %d x %d process layout!\n",
+			conf.rows, conf.cols, rowParts, colParts);
+		exit(1);
 	}
 
 	if(isSingleProcess)
@@ -258,6 +594,46 @@ void refineConfiguration(HeatConfiguration &conf, int rowValue, int colValue, bo
 		conf.processLayout.y = 1;
 	}
 
+	// Initial block boundaries of the process rows and columns
+	int count;
+	conf.rowSplit.resize(conf.processLayout.x + 1);
+	conf.colSplit.resize(conf.processLayout.y + 1);
+	for (int i = 0; i <= conf.processLayout.x; ++i) {
+		splitBlocks(conf.rowBlocks, conf.processLayout.x, i, count, conf.rowSplit[i]);
+	}
+	for (int j = 0; j <= conf.processLayout.y; ++j) {
+		splitBlocks(conf.colBlocks, conf.processLayout.y, j, count, conf.colSplit[j]);
+	}
+
+	if (conf.omega == 0.0) {
+		// Optimal SOR factor for the 5-point Laplacian on an NxN grid
+		int n = std::max(conf.rows, conf.cols);
+		conf.omega = 2.0 / (1.0 + sin(M_PI / (n + 1)));
+	}
+
+}
+
+// Split blocks among parts as evenly as possible: the first blocks % parts
+// parts get one block more
+void splitBlocks(int blocks, int parts, int part, int &count, int &offset)
+{
+	count  = blocks / parts + ((part < blocks % parts) ? 1 : 0);
+	offset = part * (blocks / parts) + std::min(part, blocks % parts);
+}
+
+// Local blocks of rank r, the position of its tile in the grid and the extent
+// of its last block row and column, which are partial at the grid edges
+void decomposeConfiguration(HeatConfiguration &conf, ProcessLayout r, int &rowBlocks, int &colBlocks)
+{
+	int rowBlockOffset = conf.rowSplit[r.x];
+	int colBlockOffset = conf.colSplit[r.y];
+	rowBlocks = conf.rowSplit[r.x+1] - rowBlockOffset;
+	colBlocks = conf.colSplit[r.y+1] - colBlockOffset;
+
+	conf.rowOffset = rowBlockOffset * BSX;
+	conf.colOffset = colBlockOffset * BSY;
+	conf.lastBlockRows = std::min(BSX, conf.rows - conf.rowOffset - (rowBlocks-1) * BSX);
+	conf.lastBlockCols = std::min(BSY, conf.cols - conf.colOffset - (colBlocks-1) * BSY);
 }
 
 void printConfiguration(const HeatConfiguration &conf)
@@ -266,6 +642,48 @@ void printConfiguration(const HeatConfiguration &conf)
 	fprintf(stdout, "Timesteps         : %u\n", conf.timesteps);
 	fprintf(stdout, "Num. heat sources : %u\n", conf.numHeatSources);
 	fprintf(stdout, "Process layout    : %u x %u\n", conf.processLayout.x, conf.processLayout.y);
+	fprintf(stdout, "Storage precision : %s\n", (sizeof(real_t) == sizeof(float)) ? "float" : "double");
+	fprintf(stdout, "Stencil           : %s\n", Stencil::name());
+	fprintf(stdout, "Relaxation factor : %.6f\n", conf.omega);
+	if (conf.solver == MULTIGRID) {
+		fprintf(stdout, "Solver            : multigrid %s-cycle\n", (conf.mgCycle == 1) ? "V" : "W");
+	} else if (conf.solver == JACOBI) {
+		fprintf(stdout, "Solver            : Jacobi\n");
+	} else {
+		fprintf(stdout, "Solver            : Gauss-Seidel\n");
+	}
+	if (!conf.ensembleFileName.empty()) {
+		fprintf(stdout, "Ensemble          : %s\n", conf.ensembleFileName.c_str());
+	}
+	if (conf.paddedBlocks) {
+		fprintf(stdout, "Padded blocks     : %s\n", (conf.solver == GAUSS_SEIDEL) ? "enabled" : "ignored by this solver");
+	}
+	if (conf.superBlocks > 1) {
+		fprintf(stdout, "Super-blocks      : %dx%d blocks\n", conf.superBlocks, conf.superBlocks);
+	}
+	if (conf.rebalanceInterval > 0) {
+		fprintf(stdout, "Rebalance interval: %d timesteps\n", conf.rebalanceInterval);
+	}
+	if (conf.haloCompression != COMPRESS_NONE) {
+		fprintf(stdout, "Halo compression  : %s\n", (conf.haloCompression == COMPRESS_ALL) ? "all neighbours" : "off-node neighbours");
+	}
+	if (conf.initialGuess == GUESS_FIELD) {
+		fprintf(stdout, "Initial guess     : %s\n", conf.guessFileName.c_str());
+	} else if (conf.initialGuess == GUESS_COARSE) {
+		fprintf(stdout, "Initial guess     : solve of the grid coarsened %d times\n", conf.guessCoarsening);
+	}
+	if (conf.generateField) {
+		fprintf(stdout, "Field file        : %s (%s blocks)\n", conf.fieldFileName.c_str(), conf.compressField ? "coded" : "raw");
+	}
+	if (!conf.traceFileName.empty()) {
+		fprintf(stdout, "Trace             : %s.json, %s.csv\n", conf.traceFileName.c_str(), conf.traceFileName.c_str());
+	}
+	if (conf.measureEnergy) {
+		fprintf(stdout, "Energy            : RAPL package and DRAM counters\n");
+	}
+	if (conf.activeBlocks) {
+		fprintf(stdout, "Active blocks     : %s (tolerance %g)\n", (conf.solver == GAUSS_SEIDEL) ? "enabled" : "ignored by this solver", conf.activeTolerance);
+	}
 	
 	for (int i = 0; i < conf.numHeatSources; i++) {
 		fprintf(stdout, "  %2d: (%2.2f, %2.2f) %2.2f %2.2f \n", i+1,
@@ -274,6 +692,11 @@ void printConfiguration(const HeatConfiguration &conf)
 			conf.heatSources[i].range,
 			conf.heatSources[i].temperature
 		);
+		for (int k = 0; k < conf.heatSources[i].numKeyframes; k++) {
+			const HeatKeyframe &key = conf.keyframes[conf.heatSources[i].firstKeyframe + k];
+			fprintf(stdout, "      at %d: (%2.2f, %2.2f) %2.2f %2.2f \n", key.step,
+				key.row, key.col, key.range, key.temperature);
+		}
 	}
 }
 
@@ -282,67 +705,277 @@ void initializeMatrix(const HeatConfiguration &conf, block_t *matrix, int rowBlo
 
 	// Set all elements to zero
 	traverseByRows(matrix, rowBlocks, colBlocks,
-		[&](int x, int y, double &value) {
+		[&](int x, int y, real_t &value) {
 			value = 0;
 		}
 	);
 }
-void initializeHalos(const HeatConfiguration &conf, block_t *matrix, int rowBlocks, int colBlocks, ProcessLayout rank2D)
+// Geometry of the boundaries: the distance of a source from the halo line
+// and its position along the line, both relative to the grid size
+struct TopHalo {
+	static double normal(const HeatSource &src) { return src.row; }
+	static double center(const HeatSource &src) { return src.col; }
+};
+
+struct BottomHalo {
+	static double normal(const HeatSource &src) { return 1 - src.row; }
+	static double center(const HeatSource &src) { return src.col; }
+};
+
+struct LeftHalo {
+	static double normal(const HeatSource &src) { return src.col; }
+	static double center(const HeatSource &src) { return src.row; }
+};
+
+struct RightHalo {
+	static double normal(const HeatSource &src) { return 1 - src.col; }
+	static double center(const HeatSource &src) { return src.row; }
+};
+
+HeatSource sourceAt(const HeatConfiguration &conf, int source, int step)
 {
-	const int totalRows = conf.rows ;
-	const int totalCols = conf.cols ;
-	const int numRows   = rowBlocks * BSX ;
-	const int numCols   = colBlocks * BSY ;
-	const int rowOffset = rowBlocks  * rank2D.x * BSX;
-	const int colOffset = colBlocks  * rank2D.y * BSY;
+	HeatSource current = conf.heatSources[source];
+	int from = 0;
+	for (int k = 0; k < current.numKeyframes; ++k) {
+		const HeatKeyframe &key = conf.keyframes[current.firstKeyframe + k];
+		if (step >= key.step) {
+			current.row = key.row;
+			current.col = key.col;
+			current.range = key.range;
+			current.temperature = key.temperature;
+			from = key.step;
+			continue;
+		}
 
+		const float f = (float) (step - from) / (float) (key.step - from);
+		current.row += f * (key.row - current.row);
+		current.col += f * (key.col - current.col);
+		current.range += f * (key.range - current.range);
+		current.temperature += f * (key.temperature - current.temperature);
+		break;
+	}
+	return current;
+}
+
+// Halo cells [first, last) that a source can reach, widened by one on each
+// side against rounding. False if the source does not reach the halo line.
+template <typename Side>
+static bool sourceSpan(const HeatSource &src, int offset, int total, double &first, double &last)
+{
+	const double normal = Side::normal(src);
+	const double center = Side::center(src);
 
+	// Half-width of the chord of the range circle on the halo line
+	const double width2 = (double) src.range * src.range - normal * normal;
+	if (width2 < 0.0) return false;
+	const double width = sqrt(width2);
 
+	first = floor((center - width) * total) - offset - 1;
+	last  = ceil ((center + width) * total) - offset + 2;
+	return true;
+}
+
+// Add the heat of every source, as of timestep step, to the boundary cells
+// [begin, end) of one halo. Cell k lies at (offset + k) / total along the
+// halo line. Only the cells whose distance can be within the range of a
+// source are visited.
+template <typename Side>
+static void initializeHaloSegment(const HeatConfiguration &conf, int step, real_t *halo, int begin, int end, int offset, int total)
+{
 	for (int i = 0; i < conf.numHeatSources; i++) {
-		const HeatSource &src = conf.heatSources[i];
-		
-		// Initialize top row
-		if (rank2D.x == 0) {
+		const HeatSource src = sourceAt(conf, i, step);
+		double first, last;
+		if (!sourceSpan<Side>(src, offset, total, first, last)) continue;
+
+		// The exact distance test decides among the candidate cells
+		first = std::max((double) begin, first);
+		last  = std::min((double) end, last);
+
+		const double normal = Side::normal(src);
+		const double center = Side::center(src);
+		for (int k = (int) first; k < (int) last; ++k) {
+			const double along = (double)(offset + k) / (double) total - center;
+			const double dist = sqrt(along * along + normal * normal);
+			if (dist <= src.range) {
+				halo[k] += (src.range - dist) / src.range * src.temperature;
+			}
+		}
+	}
+}
 
+// Boundary temperatures along the whole top, bottom, left and right sides of
+// the grid, in this order, as of timestep step
+void gridBoundary(const HeatConfiguration &conf, int step, std::vector<real_t> boundary[4])
+{
+	boundary[0].assign(conf.cols, 0);
+	boundary[1].assign(conf.cols, 0);
+	boundary[2].assign(conf.rows, 0);
+	boundary[3].assign(conf.rows, 0);
+	initializeHaloSegment<TopHalo>   (conf, step, boundary[0].data(), 0, conf.cols, 0, conf.cols);
+	initializeHaloSegment<BottomHalo>(conf, step, boundary[1].data(), 0, conf.cols, 0, conf.cols);
+	initializeHaloSegment<LeftHalo>  (conf, step, boundary[2].data(), 0, conf.rows, 0, conf.rows);
+	initializeHaloSegment<RightHalo> (conf, step, boundary[3].data(), 0, conf.rows, 0, conf.rows);
+}
 
-			traverseRowHalo(conf.halos_row[top], 0, 0, numCols,
-				[&](int x, int y, double &value) {
-					double dist = sqrt(pow((double)(colOffset + y) / (double)totalCols - src.col, 2) + pow(src.row, 2));
-					value = (dist <= src.range) ? value + (src.range - dist) / src.range * src.temperature : value;
-				}
-			);
+void initializeHalos(const HeatConfiguration &conf, block_t *matrix, int rowBlocks, int colBlocks, ProcessLayout rank2D)
+{
+	const int totalRows = conf.rows ;
+	const int totalCols = conf.cols ;
+	const int rowOffset = conf.rowOffset;
+	const int colOffset = conf.colOffset;
+	const int step = conf.step;
+
+	// Halos are contiguous arrays of BSY (rows) or BSX (cols) elements per
+	// block; each block of each boundary is an independent segment. Sources
+	// are accumulated in order inside a segment, so the result does not
+	// depend on the parallelization.
+	real_t *haloTop    = &conf.halos_row[top]   [0][0];
+	real_t *haloBottom = &conf.halos_row[bottom][0][0];
+	real_t *haloLeft   = &conf.halos_col[left]  [0][0];
+	real_t *haloRight  = &conf.halos_col[right] [0][0];
+
+	for (int by = 0; by < colBlocks; ++by) {
+		// Initialize top row
+		if (rank2D.x == 0) {
+			#pragma oss task label(initialize top halo)
+			initializeHaloSegment<TopHalo>(conf, step, haloTop, by * BSY, (by+1) * BSY, colOffset, totalCols);
 		}
 
 		// Initialize bottom row
 		if (rank2D.x == (conf.processLayout.x - 1)) {
-			traverseRowHalo(conf.halos_row[bottom], numRows-1, 0, numCols,
-				[&](int x, int y, double &value) {
-					double dist = sqrt(pow(1 - src.row, 2) + pow((double)(colOffset + y) / (double)totalCols - src.col, 2) );
-					value = (dist <= src.range) ? value + (src.range - dist) / src.range * src.temperature : value;
-				}
-			);
+			#pragma oss task label(initialize bottom halo)
+			initializeHaloSegment<BottomHalo>(conf, step, haloBottom, by * BSY, (by+1) * BSY, colOffset, totalCols);
 		}
+	}
 
+	for (int bx = 0; bx < rowBlocks; ++bx) {
 		// Initialize left column
 		if (rank2D.y == 0) {
-			traverseColHalo(conf.halos_col[left], 0, 0, numRows,
-				[&](int x, int y, double &value) {
-					double dist = sqrt(pow(src.col, 2) + pow((double)(rowOffset + x)/(double)totalRows - src.row, 2));
-					value = (dist <= src.range) ? value + (src.range - dist) / src.range * src.temperature : value;
-				}
-			);
+			#pragma oss task label(initialize left halo)
+			initializeHaloSegment<LeftHalo>(conf, step, haloLeft, bx * BSX, (bx+1) * BSX, rowOffset, totalRows);
 		}
 
 		// Initialize right column
 		if (rank2D.y == (conf.processLayout.y - 1)) {
-			traverseColHalo(conf.halos_col[right], numCols-1, 0, numRows,
-				[&](int x, int y, double &value) {
-					double dist = sqrt(pow(1 - src.col, 2) + pow((double)(rowOffset + x)/(double)totalRows - src.row, 2));
-					value = (dist <= src.range) ? value + (src.range - dist) / src.range * src.temperature : value;
-				}
-			);
+			#pragma oss task label(initialize right halo)
+			initializeHaloSegment<RightHalo>(conf, step, haloRight, bx * BSX, (bx+1) * BSX, rowOffset, totalRows);
+		}
+	}
+	#pragma oss taskwait
+}
+
+// Recompute the segments of one halo, one per block row or column, that a
+// changed source reaches at the previous or the current step. Each segment is
+// a task that only depends on that segment, and it reactivates the block next
+// to it.
+template <typename Side, typename Halo>
+static void updateHaloSegments(const HeatConfiguration &conf, const std::vector<int> &changed, Halo *halo, int segments,
+		int offset, int total, const std::vector<int> &blocks)
+{
+	const int step = conf.step;
+	const int length = sizeof(Halo) / sizeof(real_t);
+	for (int seg = 0; seg < segments; ++seg) {
+		const int begin = seg * length;
+		const int end = begin + length;
+
+		bool touched = false;
+		for (int i : changed) {
+			for (int t = step - 1; t <= step && !touched; ++t) {
+				double first, last;
+				touched = sourceSpan<Side>(sourceAt(conf, i, t), offset, total, first, last)
+					&& first < end && last > begin;
+			}
+		}
+		if (!touched) continue;
+
+		const int block = blocks[seg];
+#if defined(_OPENMP) && !defined(_OMPSS_2)
+		#pragma omp task depend(inout: halo[seg]) shared(conf)
+#else
+		#pragma oss task label(update halo) inout(halo[seg])
+#endif
+		{
+			real_t *cells = &halo[0][0];
+			std::fill(cells + begin, cells + end, (real_t) 0);
+			initializeHaloSegment<Side>(conf, step, cells, begin, end, offset, total);
+			if (conf.blockChange != nullptr) {
+				conf.blockChange[block] = HUGE_VAL;
+			}
+		}
+	}
+}
+
+void updateHalos(const HeatConfiguration &conf, int rowBlocks, int colBlocks, ProcessLayout rank2D)
+{
+	if (conf.keyframes.empty() || conf.step == 0) return;
+
+	// Sources whose position, range or temperature changed since the last step
+	std::vector<int> changed;
+	for (int i = 0; i < conf.numHeatSources; i++) {
+		const HeatSource before = sourceAt(conf, i, conf.step - 1);
+		const HeatSource now = sourceAt(conf, i, conf.step);
+		if (before.row != now.row || before.col != now.col
+				|| before.range != now.range || before.temperature != now.temperature) {
+			changed.push_back(i);
+		}
+	}
+	if (changed.empty()) return;
+
+	std::vector<int> firstRow(colBlocks), lastRow(colBlocks), firstCol(rowBlocks), lastCol(rowBlocks);
+	for (int by = 0; by < colBlocks; ++by) {
+		firstRow[by] = blockIndex(0, by, rowBlocks, colBlocks);
+		lastRow[by]  = blockIndex(rowBlocks-1, by, rowBlocks, colBlocks);
+	}
+	for (int bx = 0; bx < rowBlocks; ++bx) {
+		firstCol[bx] = blockIndex(bx, 0, rowBlocks, colBlocks);
+		lastCol[bx]  = blockIndex(bx, colBlocks-1, rowBlocks, colBlocks);
+	}
+
+	if (rank2D.x == 0) {
+		updateHaloSegments<TopHalo>(conf, changed, conf.halos_row[top], colBlocks, conf.colOffset, conf.cols, firstRow);
+	}
+	if (rank2D.x == conf.processLayout.x - 1) {
+		updateHaloSegments<BottomHalo>(conf, changed, conf.halos_row[bottom], colBlocks, conf.colOffset, conf.cols, lastRow);
+	}
+	if (rank2D.y == 0) {
+		updateHaloSegments<LeftHalo>(conf, changed, conf.halos_col[left], rowBlocks, conf.rowOffset, conf.rows, firstCol);
+	}
+	if (rank2D.y == conf.processLayout.y - 1) {
+		updateHaloSegments<RightHalo>(conf, changed, conf.halos_col[right], rowBlocks, conf.rowOffset, conf.rows, lastCol);
+	}
+}
+
+// Drop the static sources that reach none of the boundary halos of this
+// rank; they would add nothing to its cells. Sources with keyframes move, so
+// they are kept. The order of the kept sources, and so the sums in every
+// halo cell, do not change.
+void keepBoundarySources(HeatConfiguration &conf, int rowBlocks, int colBlocks, ProcessLayout rank2D)
+{
+	const int rowCells = rowBlocks * BSX;
+	const int colCells = colBlocks * BSY;
+
+	int kept = 0;
+	for (int i = 0; i < conf.numHeatSources; i++) {
+		const HeatSource &src = conf.heatSources[i];
+		double first, last;
+		bool reaches = (src.numKeyframes > 0);
+		if (!reaches && rank2D.x == 0) {
+			reaches = sourceSpan<TopHalo>(src, conf.colOffset, conf.cols, first, last) && first < colCells && last > 0;
+		}
+		if (!reaches && rank2D.x == conf.processLayout.x - 1) {
+			reaches = sourceSpan<BottomHalo>(src, conf.colOffset, conf.cols, first, last) && first < colCells && last > 0;
+		}
+		if (!reaches && rank2D.y == 0) {
+			reaches = sourceSpan<LeftHalo>(src, conf.rowOffset, conf.rows, first, last) && first < rowCells && last > 0;
+		}
+		if (!reaches && rank2D.y == conf.processLayout.y - 1) {
+			reaches = sourceSpan<RightHalo>(src, conf.rowOffset, conf.rows, first, last) && first < rowCells && last > 0;
+		}
+		if (reaches) {
+			conf.heatSources[kept++] = src;
 		}
 	}
+	conf.numHeatSources = kept;
 }
 
 double get_time()
@@ -0,0 +1,302 @@
+#ifndef MULTIGRID_HPP
+#define MULTIGRID_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "common/matrix.hpp"
+
+// Number of smoothing sweeps before and after each coarse-grid correction
+#define MG_PRE_SWEEPS  2
+#define MG_POST_SWEEPS 2
+
+// Sweeps used to solve the coarsest level
+#define MG_COARSEST_SWEEPS 50
+
+// Grid transfers along one dimension between a level of n cells and the
+// next coarser one, both over the same length. A fine cell covers a part of
+// coarse cell first[i] and, if share[i] < 1, the rest of the next one; its
+// residual is split between them in these proportions. The correction at
+// the center of fine cell i is interpolated linearly between coarse cells
+// below[i] (-1 for the ghost) and below[i] + 1, the latter with weight[i].
+struct MultigridTransfer {
+	std::vector<int> first;
+	std::vector<double> share;
+	std::vector<int> below;
+	std::vector<double> weight;
+};
+
+// Transfers between n fine cells of width fineWidth and m coarse cells of
+// width coarseWidth, both in cells of the blocked grid
+inline void createTransfer(MultigridTransfer &transfer, int n, double fineWidth, int m, double coarseWidth)
+{
+	transfer.first.resize(n);
+	transfer.share.resize(n);
+	transfer.below.resize(n);
+	transfer.weight.resize(n);
+
+	for (int i = 0; i < n; ++i) {
+		const double begin = i * fineWidth;
+		const int c = std::min((int) (begin / coarseWidth), m - 1);
+		const double end = std::min((i + 1) * fineWidth, (c + 1) * coarseWidth);
+		transfer.first[i] = c;
+		transfer.share[i] = (c == m - 1) ? 1.0 : (end - begin) / fineWidth;
+
+		const double center = (i + 0.5) * fineWidth / coarseWidth - 0.5;
+		transfer.below[i] = (int) std::floor(center);
+		transfer.weight[i] = center - transfer.below[i];
+	}
+}
+
+// Cell-centered coarse level: the unknowns e and the right-hand side f of
+// L e = f, with L the 5-point Laplacian scaled by the cell area. The cells
+// are wx x wy cells of the blocked grid, so L e = ax (2 e - vertical
+// neighbours) + ay (2 e - horizontal neighbours) with ax = wy / wx and ay =
+// wx / wy. Both arrays have a zero ghost frame, so they are (rows+2) x
+// (cols+2). The correction vanishes on the fine halos, which lie between the
+// ghost and the first cell of a coarse level; a ghost value of -gx (or -gy)
+// times the adjacent cell interpolates to zero there and is folded into the
+// diagonal.
+struct MultigridLevel {
+	int rows;
+	int cols;
+	double ax;
+	double ay;
+	double gx;
+	double gy;
+	double *e;
+	double *f;
+	MultigridTransfer rowTransfer;  // from the next finer level
+	MultigridTransfer colTransfer;
+
+	double &E(int x, int y) { return e[(x+1) * (cols+2) + (y+1)]; }
+	double &F(int x, int y) { return f[(x+1) * (cols+2) + (y+1)]; }
+
+	double diagonal(int x, int y)
+	{
+		return 2.0 * ax + 2.0 * ay + ax * gx * ((x == 0) + (x == rows-1)) + ay * gy * ((y == 0) + (y == cols-1));
+	}
+
+	// Value at (x, y), extrapolated from the boundary cell on the ghost frame
+	double value(int x, int y)
+	{
+		double factor = 1.0;
+		if (x < 0)     { x = 0;      factor *= -gx; }
+		if (x >= rows) { x = rows-1; factor *= -gx; }
+		if (y < 0)     { y = 0;      factor *= -gy; }
+		if (y >= cols) { y = cols-1; factor *= -gy; }
+		return factor * E(x, y);
+	}
+};
+
+// Coarse levels below the block_t grid, from finest to coarsest
+struct MultigridHierarchy {
+	std::vector<MultigridLevel> levels;
+	int cycleIndex;
+};
+
+// Halve the grid, rounding up, while both dimensions are at least 4 cells
+// wide. Odd dimensions give coarse cells somewhat narrower than twice the
+// finer ones, all of the same width.
+inline void createHierarchy(MultigridHierarchy &mg, int rows, int cols, int cycleIndex)
+{
+	mg.cycleIndex = cycleIndex;
+
+	const int gridRows = rows;
+	const int gridCols = cols;
+	double wx = 1.0, wy = 1.0;
+	while (rows >= 4 && cols >= 4) {
+		const int fineRows = rows, fineCols = cols;
+		const double fineWx = wx, fineWy = wy;
+		rows = (rows + 1) / 2;
+		cols = (cols + 1) / 2;
+		wx = (double) gridRows / rows;
+		wy = (double) gridCols / cols;
+
+		mg.levels.push_back(MultigridLevel());
+		MultigridLevel &level = mg.levels.back();
+		level.rows = rows;
+		level.cols = cols;
+		level.ax = wy / wx;
+		level.ay = wx / wy;
+		level.gx = (wx - 1.0) / (wx + 1.0);
+		level.gy = (wy - 1.0) / (wy + 1.0);
+		createTransfer(level.rowTransfer, fineRows, fineWx, rows, wx);
+		createTransfer(level.colTransfer, fineCols, fineWy, cols, wy);
+		level.e = (double *) calloc((rows+2) * (cols+2), sizeof(double));
+		level.f = (double *) calloc((rows+2) * (cols+2), sizeof(double));
+		if (level.e == NULL || level.f == NULL) {
+			fprintf(stderr, "Error: Memory cannot be allocated!\n");
+			exit(1);
+		}
+	}
+}
+
+inline void destroyHierarchy(MultigridHierarchy &mg)
+{
+	for (size_t l = 0; l < mg.levels.size(); ++l) {
+		free(mg.levels[l].e);
+		free(mg.levels[l].f);
+	}
+	mg.levels.clear();
+}
+
+// Element (x, y) of the rows x cols blocked grid, falling back to the halos
+// outside it
+inline double gridElement(block_t *matrix, row_t **halo_row, col_t **halo_col, int nbx, int nby, int rows, int cols, int x, int y)
+{
+	if (x < 0)      return halo_row[top]   [y / BSY][y % BSY];
+	if (x >= rows)  return halo_row[bottom][y / BSY][y % BSY];
+	if (y < 0)      return halo_col[left]  [x / BSX][x % BSX];
+	if (y >= cols)  return halo_col[right] [x / BSX][x % BSX];
+	return matrix[blockIndex(x / BSX, y / BSY, nbx, nby)][x % BSX][y % BSY];
+}
+
+// Add the residual r of fine cell (x, y) to the coarse cells it covers
+inline void restrictResidual(MultigridLevel &coarse, int x, int y, double r)
+{
+	const int cx = coarse.rowTransfer.first[x];
+	const int cy = coarse.colTransfer.first[y];
+	const double sx = coarse.rowTransfer.share[x];
+	const double sy = coarse.colTransfer.share[y];
+
+	coarse.F(cx, cy) += sx * sy * r;
+	if (sx < 1.0)             coarse.F(cx+1, cy)   += (1.0 - sx) * sy * r;
+	if (sy < 1.0)             coarse.F(cx,   cy+1) += sx * (1.0 - sy) * r;
+	if (sx < 1.0 && sy < 1.0) coarse.F(cx+1, cy+1) += (1.0 - sx) * (1.0 - sy) * r;
+}
+
+// Residual of the fine grid restricted to the first coarse level. The
+// coarse right-hand side is the sum of the residuals of the fine cells
+// within each coarse cell, which accounts for the area scaling of the
+// operator.
+inline void restrictGrid(block_t *matrix, row_t **halo_row, col_t **halo_col, int nbx, int nby, int rows, int cols, MultigridLevel &coarse)
+{
+	memset(coarse.f, 0, (coarse.rows+2) * (coarse.cols+2) * sizeof(double));
+
+	for (int x = 0; x < rows; ++x) {
+		for (int y = 0; y < cols; ++y) {
+			double r = gridElement(matrix, halo_row, halo_col, nbx, nby, rows, cols, x-1, y)
+				+ gridElement(matrix, halo_row, halo_col, nbx, nby, rows, cols, x+1, y)
+				+ gridElement(matrix, halo_row, halo_col, nbx, nby, rows, cols, x, y-1)
+				+ gridElement(matrix, halo_row, halo_col, nbx, nby, rows, cols, x, y+1)
+				- 4.0 * matrix[blockIndex(x / BSX, y / BSY, nbx, nby)][x % BSX][y % BSY];
+			restrictResidual(coarse, x, y, r);
+		}
+	}
+}
+
+// Residual of a coarse level restricted to the next one
+inline void restrictLevel(MultigridLevel &fine, MultigridLevel &coarse)
+{
+	memset(coarse.f, 0, (coarse.rows+2) * (coarse.cols+2) * sizeof(double));
+
+	for (int x = 0; x < fine.rows; ++x) {
+		for (int y = 0; y < fine.cols; ++y) {
+			double r = fine.F(x, y) + fine.ax * fine.E(x-1, y) + fine.ax * fine.E(x+1, y)
+				+ fine.ay * fine.E(x, y-1) + fine.ay * fine.E(x, y+1) - fine.diagonal(x, y) * fine.E(x, y);
+			restrictResidual(coarse, x, y, r);
+		}
+	}
+}
+
+// Bilinear interpolation of the coarse correction at fine cell (x, y)
+inline double interpolate(MultigridLevel &coarse, int x, int y)
+{
+	const int cx = coarse.rowTransfer.below[x];
+	const int cy = coarse.colTransfer.below[y];
+	const double tx = coarse.rowTransfer.weight[x];
+	const double ty = coarse.colTransfer.weight[y];
+
+	return (1.0 - tx) * ((1.0 - ty) * coarse.value(cx, cy) + ty * coarse.value(cx, cy+1))
+		+ tx * ((1.0 - ty) * coarse.value(cx+1, cy) + ty * coarse.value(cx+1, cy+1));
+}
+
+// Add the interpolated correction of the first coarse level to the grid
+inline void prolongGrid(MultigridLevel &coarse, block_t *matrix, int nbx, int nby, int rows, int cols)
+{
+	traverseByRows(matrix, nbx, nby, rows, cols,
+		[&](int x, int y, real_t &value) {
+			value += interpolate(coarse, x, y);
+		}
+	);
+}
+
+inline void prolongLevel(MultigridLevel &coarse, MultigridLevel &fine)
+{
+	for (int x = 0; x < fine.rows; ++x) {
+		for (int y = 0; y < fine.cols; ++y) {
+			fine.E(x, y) += interpolate(coarse, x, y);
+		}
+	}
+}
+
+// Lexicographic Gauss-Seidel sweeps on L e = f
+inline void smoothLevel(MultigridLevel &level, int sweeps)
+{
+	for (int s = 0; s < sweeps; ++s) {
+		for (int x = 0; x < level.rows; ++x) {
+			for (int y = 0; y < level.cols; ++y) {
+				level.E(x, y) = (level.F(x, y) + level.ax * level.E(x-1, y) + level.ax * level.E(x+1, y)
+					+ level.ay * level.E(x, y-1) + level.ay * level.E(x, y+1)) / level.diagonal(x, y);
+			}
+		}
+	}
+}
+
+inline void clearLevel(MultigridLevel &level)
+{
+	memset(level.e, 0, (level.rows+2) * (level.cols+2) * sizeof(double));
+}
+
+// Improve the approximation of L e = f on level l
+inline void cycleLevel(MultigridHierarchy &mg, size_t l)
+{
+	MultigridLevel &level = mg.levels[l];
+
+	if (l == mg.levels.size() - 1) {
+		smoothLevel(level, MG_COARSEST_SWEEPS);
+		return;
+	}
+
+	MultigridLevel &coarse = mg.levels[l+1];
+
+	smoothLevel(level, MG_PRE_SWEEPS);
+	restrictLevel(level, coarse);
+	clearLevel(coarse);
+	for (int c = 0; c < mg.cycleIndex; ++c) {
+		cycleLevel(mg, l+1);
+	}
+	prolongLevel(coarse, level);
+	smoothLevel(level, MG_POST_SWEEPS);
+}
+
+// One V-cycle (cycleIndex 1) or W-cycle (cycleIndex 2) on the rows x cols
+// blocked grid.
+// The smoother performs one sweep of the solver over the whole grid and must
+// have completed when it returns.
+template <typename Smoother>
+inline void multigridCycle(block_t *matrix, row_t **halo_row, col_t **halo_col, int nbx, int nby, int rows, int cols, MultigridHierarchy &mg, Smoother smooth)
+{
+	for (int s = 0; s < MG_PRE_SWEEPS; ++s) {
+		smooth();
+	}
+
+	if (!mg.levels.empty()) {
+		restrictGrid(matrix, halo_row, halo_col, nbx, nby, rows, cols, mg.levels[0]);
+		clearLevel(mg.levels[0]);
+		for (int c = 0; c < mg.cycleIndex; ++c) {
+			cycleLevel(mg, 0);
+		}
+		prolongGrid(mg.levels[0], matrix, nbx, nby, rows, cols);
+	}
+
+	for (int s = 0; s < MG_POST_SWEEPS; ++s) {
+		smooth();
+	}
+}
+
+#endif // MULTIGRID_HPP
@@ -0,0 +1,94 @@
+#ifndef PADDED_HPP
+#define PADDED_HPP
+
+#include <cassert>
+
+#include "common/heat.hpp"
+#include "common/activity.hpp"
+#include "common/matrix.hpp"
+#include "common/trace.hpp"
+
+// Gauss-Seidel sweeps over padded blocks (see paddedBlock_t). Each block
+// refreshes its ghost frame right before it is swept, so the frame holds the
+// same values that the unpadded kernels read from the neighbouring blocks
+// and the results are identical.
+
+template <bool Partial, bool Relaxed>
+inline double solvePaddedBlock(paddedBlock_t &block, int nx, int ny, double omega)
+{
+	const int rows = Partial ? nx : BSX;
+	const int cols = Partial ? ny : BSY;
+
+	double sum = 0.0;
+	for (int x = 1; x <= rows; ++x) {
+		for (int y = 1; y <= cols; ++y) {
+			double current = block[x][y];
+			double value = 0.25 * ((double) block[x-1][y] + block[x+1][y] + block[x][y-1] + block[x][y+1]);
+			if (Relaxed) {
+				// Successive over-relaxation of the Gauss-Seidel update
+				value = current + omega * (value - current);
+			}
+			double diff = value - current;
+			sum += diff * diff;
+
+			block[x][y] = value;
+		}
+	}
+
+	return sum;
+}
+
+// Update one padded block unless active-region tracking shows that it cannot
+// change
+inline double updatePaddedBlock(paddedBlock_t *padded, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, const HeatConfiguration &conf, int step)
+{
+	double *change = conf.blockChange;
+	if (change != nullptr && !isBlockActive(change, nbx, nby, bx, by, conf.activeTolerance)) {
+		change[blockIndex(bx, by, nbx, nby)] = 0.0;
+		return 0.0;
+	}
+
+	const int nx = (bx == nbx-1) ? conf.lastBlockRows : BSX;
+	const int ny = (by == nby-1) ? conf.lastBlockCols : BSY;
+	const double traced = traceBegin();
+
+	refreshGhosts(padded, halo_row, halo_col, nbx, nby, bx, by, nx, ny);
+
+	// Plain Gauss-Seidel skips the blend of the over-relaxation
+	paddedBlock_t &block = padded[blockIndex(bx, by, nbx, nby)];
+	const bool full = (nx == BSX && ny == BSY);
+	double sum;
+	if (conf.omega == 1.0) {
+		sum = full ? solvePaddedBlock<false, false>(block, BSX, BSY, conf.omega) : solvePaddedBlock<true, false>(block, nx, ny, conf.omega);
+	} else {
+		sum = full ? solvePaddedBlock<false, true>(block, BSX, BSY, conf.omega) : solvePaddedBlock<true, true>(block, nx, ny, conf.omega);
+	}
+
+	if (change != nullptr) {
+		change[blockIndex(bx, by, nbx, nby)] = sum;
+	}
+	traceEnd(TRACE_BLOCK, bx, by, step, traced);
+
+	return sum;
+}
+
+// Padded copy of the grid of conf, allocated by initialize() and kept across
+// solves. It only has to be filled from the grid when the grid was written
+// outside a padded solve, which clears conf.paddedCurrent.
+inline paddedBlock_t *enterPadded(HeatConfiguration &conf, const block_t *matrix, int nbx, int nby)
+{
+	assert(conf.paddedMatrix != nullptr);
+	if (!conf.paddedCurrent) {
+		padBlocks(matrix, conf.paddedMatrix, nbx * nby);
+	}
+	return conf.paddedMatrix;
+}
+
+// Copy the solution back to the grid, which is what every reader sees
+inline void leavePadded(HeatConfiguration &conf, block_t *matrix, int nbx, int nby)
+{
+	unpadBlocks(conf.paddedMatrix, matrix, nbx * nby);
+	conf.paddedCurrent = true;
+}
+
+#endif // PADDED_HPP
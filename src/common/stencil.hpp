@@ -0,0 +1,263 @@
+#ifndef STENCIL_HPP
+#define STENCIL_HPP
+
+#include <algorithm>
+
+#include "common/matrix.hpp"
+#include "common/subtile.hpp"
+
+// Stencil of the Gauss-Seidel sweeps (build with STENCIL=5, 9 or 4th). A
+// stencil lists the offsets and weights of the neighbours of a cell at
+// compile time; each update relaxes the cell towards scale times the
+// weighted sum of its neighbours, which solves the Laplace equation as
+// discretized by the stencil:
+//  - 5:   the 5-point Laplacian, second order
+//  - 9:   the compact 9-point (Mehrstellen) Laplacian, fourth order for the
+//         Laplace equation; it also reads the diagonal neighbours
+//  - 4th: the fourth-order cross, which reads two cells along the row and
+//         the column on each side
+// The points are summed in order, so the 5-point stencil gives the values of
+// the former hand-written kernel.
+struct StencilPoint {
+	int dx;
+	int dy;
+	double weight;
+};
+
+struct FivePointStencil {
+	static constexpr int radius = 1;
+	static constexpr bool diagonal = false;
+	static constexpr int size = 4;
+	static constexpr double scale = 1.0 / 4.0;
+
+	static constexpr StencilPoint point(int i)
+	{
+		return (i == 0) ? StencilPoint {-1,  0, 1.0}
+			: (i == 1) ? StencilPoint { 1,  0, 1.0}
+			: (i == 2) ? StencilPoint { 0, -1, 1.0}
+			:            StencilPoint { 0,  1, 1.0};
+	}
+
+	static const char *name() { return "5-point"; }
+};
+
+struct NinePointStencil {
+	static constexpr int radius = 1;
+	static constexpr bool diagonal = true;
+	static constexpr int size = 8;
+	static constexpr double scale = 1.0 / 20.0;
+
+	static constexpr StencilPoint point(int i)
+	{
+		return (i == 0) ? StencilPoint {-1,  0, 4.0}
+			: (i == 1) ? StencilPoint { 1,  0, 4.0}
+			: (i == 2) ? StencilPoint { 0, -1, 4.0}
+			: (i == 3) ? StencilPoint { 0,  1, 4.0}
+			: (i == 4) ? StencilPoint {-1, -1, 1.0}
+			: (i == 5) ? StencilPoint {-1,  1, 1.0}
+			: (i == 6) ? StencilPoint { 1, -1, 1.0}
+			:            StencilPoint { 1,  1, 1.0};
+	}
+
+	static const char *name() { return "9-point"; }
+};
+
+struct FourthOrderStencil {
+	static constexpr int radius = 2;
+	static constexpr bool diagonal = false;
+	static constexpr int size = 8;
+	static constexpr double scale = 1.0 / 60.0;
+
+	static constexpr StencilPoint point(int i)
+	{
+		return (i == 0) ? StencilPoint {-1,  0, 16.0}
+			: (i == 1) ? StencilPoint { 1,  0, 16.0}
+			: (i == 2) ? StencilPoint { 0, -1, 16.0}
+			: (i == 3) ? StencilPoint { 0,  1, 16.0}
+			: (i == 4) ? StencilPoint {-2,  0, -1.0}
+			: (i == 5) ? StencilPoint { 2,  0, -1.0}
+			: (i == 6) ? StencilPoint { 0, -2, -1.0}
+			:            StencilPoint { 0,  2, -1.0};
+	}
+
+	static const char *name() { return "fourth-order"; }
+};
+
+#ifndef HEAT_STENCIL
+#define HEAT_STENCIL 5
+#endif
+
+#if HEAT_STENCIL == 9
+typedef NinePointStencil Stencil;
+#elif HEAT_STENCIL == 4
+typedef FourthOrderStencil Stencil;
+#else
+typedef FivePointStencil Stencil;
+#endif
+
+// Rows and columns of halos that the stencil reads beyond a tile. Halo row d
+// of block column by is halo_row[side][d * nby + by], and likewise for the
+// columns, so depth 0 keeps the layout of a single halo.
+const int HaloDepth = Stencil::radius;
+
+static_assert(BSX >= HaloDepth && BSY >= HaloDepth, "The blocks must be as large as the stencil radius");
+
+// Depths of the halos around a tile that hold values. The halos exchanged
+// with other ranks hold HaloDepth rows or columns; the boundary halos hold
+// one, and the cells beyond it take the boundary value.
+struct HaloDepths {
+	int rows[2];  // top, bottom
+	int cols[2];  // left, right
+};
+
+const HaloDepths BoundaryHalos = {{1, 1}, {1, 1}};
+
+// Row x of the tile around block (bx, by), for -HaloDepth <= x < rows +
+// HaloDepth: a row of the block, of the block above or below, or a halo
+inline const real_t *stencilRow(const block_t *matrix, row_t ** halo_row, const HaloDepths &depths,
+		int nbx, int nby, int bx, int by, int rows, int x)
+{
+	if (x < 0) {
+		return (bx == 0)
+			? halo_row[top][std::min(-1 - x, depths.rows[top] - 1) * nby + by]
+			: matrix[blockIndex(bx-1, by, nbx, nby)][BSX + x];
+	}
+	if (x >= rows) {
+		return (bx == nbx-1)
+			? halo_row[bottom][std::min(x - rows, depths.rows[bottom] - 1) * nby + by]
+			: matrix[blockIndex(bx+1, by, nbx, nby)][x - rows];
+	}
+	return matrix[blockIndex(bx, by, nbx, nby)][x];
+}
+
+// Cell (x, y) of the tile around block (bx, by), in any of the neighbouring
+// blocks or halos. Beyond a corner of the grid, the cell of the halo row
+// nearest to it is taken.
+inline double stencilCell(const block_t *matrix, row_t ** halo_row, col_t ** halo_col, const HaloDepths &depths,
+		int nbx, int nby, int bx, int by, int rows, int cols, int x, int y)
+{
+	if (x < 0 || x >= rows) {
+		const int side = (x < 0) ? top : bottom;
+		const int d = (x < 0) ? -1 - x : x - rows;
+		if (bx == ((x < 0) ? 0 : nbx-1)) {
+			if (y < 0) {
+				if (by == 0) y = 0; else { --by; y += BSY; }
+			} else if (y >= cols) {
+				if (by == nby-1) y = cols-1; else { ++by; y -= cols; }
+			}
+			return halo_row[side][std::min(d, depths.rows[side] - 1) * nby + by][y];
+		}
+		x = (x < 0) ? BSX + x : d;
+		bx += (side == top) ? -1 : 1;
+	}
+
+	if (y < 0 || y >= cols) {
+		const int side = (y < 0) ? left : right;
+		const int d = (y < 0) ? -1 - y : y - cols;
+		if (by == ((y < 0) ? 0 : nby-1)) {
+			return halo_col[side][std::min(d, depths.cols[side] - 1) * nbx + bx][x];
+		}
+		y = (y < 0) ? BSY + y : d;
+		by += (side == left) ? -1 : 1;
+	}
+
+	return matrix[blockIndex(bx, by, nbx, nby)][x][y];
+}
+
+// Weighted sum of the neighbours of cell y of the row whose rows -radius ..
+// radius are in row, for cells whose neighbours all lie within the rows
+template <typename S>
+inline double stencilSum(const real_t * const *row, int y)
+{
+	double sum = S::point(0).weight * row[S::radius + S::point(0).dx][y + S::point(0).dy];
+	for (int i = 1; i < S::size; ++i) {
+		sum += S::point(i).weight * row[S::radius + S::point(i).dx][y + S::point(i).dy];
+	}
+	return sum;
+}
+
+// Gauss-Seidel update of block (bx, by), over-relaxed by omega when Relaxed;
+// returns the sum of the squared updates. Full blocks keep the compile-time
+// extents; the partial blocks at the bottom and right edges of the grid use
+// the given ones. The rows that the stencil reads are looked up once per row,
+// so only the cells within the radius of the block sides need the general
+// lookup.
+template <bool Partial, bool Relaxed>
+inline double solveStencilBlock(block_t *matrix, row_t ** halo_row, col_t ** halo_col, const HaloDepths &depths,
+		int nbx, int nby, int bx, int by, int nx, int ny, double omega)
+{
+	const int rows = Partial ? nx : BSX;
+	const int cols = Partial ? ny : BSY;
+	const int R = Stencil::radius;
+
+	block_t &targetBlock = matrix[blockIndex(bx, by, nbx, nby)];
+
+	double sum = 0.0;
+	sweepSubTiles<Stencil::diagonal>(targetBlock, rows, cols, [&](int x, int y0, int y1) {
+
+		const real_t *row[2*R + 1];
+		for (int dx = -R; dx <= R; ++dx) {
+			row[R + dx] = stencilRow(matrix, halo_row, depths, nbx, nby, bx, by, rows, x + dx);
+		}
+
+		auto sideSum = [&](int y) {
+			double sum = 0.0;
+			for (int i = 0; i < Stencil::size; ++i) {
+				const StencilPoint p = Stencil::point(i);
+				const double cell = (y + p.dy >= 0 && y + p.dy < cols)
+					? (double) row[R + p.dx][y + p.dy]
+					: stencilCell(matrix, halo_row, halo_col, depths, nbx, nby, bx, by, rows, cols, x + p.dx, y + p.dy);
+				sum = (i == 0) ? p.weight * cell : sum + p.weight * cell;
+			}
+			return sum;
+		};
+
+		auto relax = [&](int y, double neighbours) {
+			double current = targetBlock[x][y];
+			double value = Stencil::scale * neighbours;
+			if (Relaxed) {
+				// Successive over-relaxation of the Gauss-Seidel update
+				value = current + omega * (value - current);
+			}
+			double diff = value - current;
+			sum += diff * diff;
+
+			targetBlock[x][y] = value;
+		};
+
+		// Only the cells next to the block sides read beyond the rows
+		const int begin = std::min(std::max(y0, R), y1);
+		const int end = std::max(std::min(y1, cols - R), begin);
+
+		for (int y = y0; y < begin; ++y) {
+			relax(y, sideSum(y));
+		}
+		for (int y = begin; y < end; ++y) {
+			relax(y, stencilSum<Stencil>(row, y));
+		}
+		for (int y = end; y < y1; ++y) {
+			relax(y, sideSum(y));
+		}
+	});
+
+	return sum;
+}
+
+// Gauss-Seidel update of block (bx, by), which holds nx x ny cells, by the
+// kernel for its extents. Plain Gauss-Seidel (omega 1) skips the blend of
+// the over-relaxation, which costs time and rounds differently.
+inline double solveStencil(block_t *matrix, row_t ** halo_row, col_t ** halo_col, const HaloDepths &depths,
+		int nbx, int nby, int bx, int by, int nx, int ny, double omega)
+{
+	const bool full = (nx == BSX && ny == BSY);
+	if (omega == 1.0) {
+		return full
+			? solveStencilBlock<false, false>(matrix, halo_row, halo_col, depths, nbx, nby, bx, by, BSX, BSY, omega)
+			: solveStencilBlock<true, false> (matrix, halo_row, halo_col, depths, nbx, nby, bx, by, nx, ny, omega);
+	}
+	return full
+		? solveStencilBlock<false, true>(matrix, halo_row, halo_col, depths, nbx, nby, bx, by, BSX, BSY, omega)
+		: solveStencilBlock<true, true> (matrix, halo_row, halo_col, depths, nbx, nby, bx, by, nx, ny, omega);
+}
+
+#endif // STENCIL_HPP
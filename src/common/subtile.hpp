@@ -0,0 +1,63 @@
+#ifndef SUBTILE_HPP
+#define SUBTILE_HPP
+
+#include <algorithm>
+
+#include "common/matrix.hpp"
+
+// Sub-tile extents of the Gauss-Seidel block sweeps (build with TSX=rows
+// TSY=cols). A task still updates a whole block, but sweeps it in sub-tiles
+// whose rows stay in L1/L2 between their uses.
+#ifndef TSX
+#define TSX 128
+#endif
+
+#ifndef TSY
+#define TSY 256
+#endif
+
+// Cache lines of count cells starting at cells, which are about to be updated
+inline void prefetchCells(const real_t *cells, int count)
+{
+#if defined(__GNUC__)
+	for (int i = 0; i < count; i += 64 / sizeof(real_t)) {
+		__builtin_prefetch(cells + i, 1, 3);
+	}
+#endif
+}
+
+// Sweep the first rows x cols cells of a block in sub-tiles of TSX x TSY
+// cells, the tiles in row-major order and the rows of a tile in order; row(x,
+// y0, y1) updates the cells [y0, y1) of row x. Every cell still comes after
+// its top and left neighbours and before its bottom and right ones, so a
+// Gauss-Seidel sweep of a stencil without diagonal points gives the same
+// values as a row-major one. A diagonal stencil also reads the cell above and
+// to the right, which the next tile only updates later, so FullRows sweeps
+// bands of whole rows instead. While a row of a tile is updated, the matching
+// row of the next tile is prefetched.
+template <bool FullRows, typename RowUpdate>
+inline void sweepSubTiles(const block_t &block, int rows, int cols, RowUpdate row)
+{
+	const int tileCols = FullRows ? cols : TSY;
+
+	for (int x0 = 0; x0 < rows; x0 += TSX) {
+		const int x1 = std::min(x0 + TSX, rows);
+		for (int y0 = 0; y0 < cols; y0 += tileCols) {
+			const int y1 = std::min(y0 + tileCols, cols);
+
+			// The next tile is on the right, or the first one of the next band
+			const int nextX = (y1 < cols) ? x0 : x1;
+			const int nextY = (y1 < cols) ? y1 : 0;
+			const int nextCols = std::min(nextY + tileCols, cols) - nextY;
+
+			for (int x = x0; x < x1; ++x) {
+				if (nextX + x - x0 < rows) {
+					prefetchCells(&block[nextX + x - x0][nextY], nextCols);
+				}
+				row(x, y0, y1);
+			}
+		}
+	}
+}
+
+#endif // SUBTILE_HPP
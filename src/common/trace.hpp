@@ -0,0 +1,203 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/heat.hpp"
+
+// Execution trace (-T). While a solve is traced, every thread appends the
+// begin and end of the block updates, halo transfers and halo waits to a ring
+// buffer of its own, so recording takes no lock; once a buffer is full, its
+// oldest records are overwritten. At exit the records are written as a Chrome
+// trace (NAME.json, for chrome://tracing or Perfetto, one process per rank
+// and one track per thread) and as CSV (NAME.csv).
+enum TraceKind {
+	TRACE_BLOCK,  // update of block (bx, by)
+	TRACE_SEND,   // halo send of slot by on edge bx
+	TRACE_RECV,   // halo receive of slot by on edge bx
+	TRACE_WAIT,   // wait for the halos of a step
+	NUM_TRACE_KINDS
+};
+
+struct TraceRecord {
+	double begin;
+	double end;
+	int kind;
+	int bx;
+	int by;
+	int step;
+	int thread;
+	int rank;
+};
+
+// Records kept per thread
+const uint64_t TraceCapacity = 1 << 16;
+
+struct TraceBuffer {
+	std::vector<TraceRecord> records;
+	uint64_t count;
+	int thread;
+};
+
+// The flag is only switched while the traced threads are idle; the workers
+// and the request poller read it concurrently, so it is atomic, with relaxed
+// accesses as it orders no other data.
+struct Tracer {
+	std::atomic<bool> enabled;
+	std::mutex lock;
+	std::vector<std::unique_ptr<TraceBuffer> > buffers;
+
+	Tracer() : enabled(false)
+	{
+	}
+};
+
+inline Tracer &tracer()
+{
+	static Tracer t;
+	return t;
+}
+
+inline void startTrace()
+{
+	tracer().enabled.store(true, std::memory_order_relaxed);
+}
+
+inline void stopTrace()
+{
+	tracer().enabled.store(false, std::memory_order_relaxed);
+}
+
+// Buffer of the calling thread, registered on its first record
+inline TraceBuffer &traceBuffer()
+{
+	static thread_local TraceBuffer *buffer = nullptr;
+	if (buffer == nullptr) {
+		Tracer &t = tracer();
+		std::lock_guard<std::mutex> guard(t.lock);
+		t.buffers.emplace_back(new TraceBuffer());
+		buffer = t.buffers.back().get();
+		buffer->records.resize(TraceCapacity);
+		buffer->count = 0;
+		buffer->thread = t.buffers.size() - 1;
+	}
+	return *buffer;
+}
+
+inline double traceBegin()
+{
+	return tracer().enabled.load(std::memory_order_relaxed) ? get_time() : 0.0;
+}
+
+inline void traceEnd(TraceKind kind, int bx, int by, int step, double begin)
+{
+	if (!tracer().enabled.load(std::memory_order_relaxed)) return;
+
+	TraceBuffer &buffer = traceBuffer();
+	buffer.records[buffer.count++ % TraceCapacity] = TraceRecord {begin, get_time(), kind, bx, by, step, buffer.thread, 0};
+}
+
+// Records of every thread in begin order, timed from origin. Call it once
+// the traced threads are idle.
+inline std::vector<TraceRecord> collectTrace(double origin, int rank)
+{
+	Tracer &t = tracer();
+	std::lock_guard<std::mutex> guard(t.lock);
+
+	std::vector<TraceRecord> records;
+	uint64_t dropped = 0;
+	for (const std::unique_ptr<TraceBuffer> &buffer : t.buffers) {
+		uint64_t first = (buffer->count > TraceCapacity) ? buffer->count - TraceCapacity : 0;
+		dropped += first;
+		for (uint64_t i = first; i < buffer->count; ++i) {
+			TraceRecord record = buffer->records[i % TraceCapacity];
+			record.begin -= origin;
+			record.end -= origin;
+			record.rank = rank;
+			records.push_back(record);
+		}
+	}
+	if (dropped > 0) {
+		fprintf(stderr, "Warning: %lu trace records of rank %d were overwritten!\n", (unsigned long) dropped, rank);
+	}
+
+	std::stable_sort(records.begin(), records.end(), [](const TraceRecord &a, const TraceRecord &b) {
+		return a.begin < b.begin;
+	});
+	return records;
+}
+
+// Names of the kinds and of the halo edges (in the order of HaloEdge)
+inline const char *traceKindName(int kind)
+{
+	static const char *names[NUM_TRACE_KINDS] = {"block", "send", "recv", "wait"};
+	return names[kind];
+}
+
+inline const char *traceEdgeName(int edge)
+{
+	static const char *names[4] = {"top", "bottom", "left", "right"};
+	return names[edge];
+}
+
+inline FILE *openTraceFile(const std::string &fileName)
+{
+	FILE *file = fopen(fileName.c_str(), "w");
+	if (file == nullptr) {
+		fprintf(stderr, "Error: Trace file %s cannot be written!\n", fileName.c_str());
+		exit(1);
+	}
+	return file;
+}
+
+// Write NAME.json (times in microseconds) and NAME.csv (times in seconds)
+inline void writeTrace(const std::string &name, const std::vector<TraceRecord> &records)
+{
+	FILE *json = openTraceFile(name + ".json");
+	fprintf(json, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+	int ranks = 0;
+	for (const TraceRecord &record : records) {
+		ranks = std::max(ranks, record.rank + 1);
+	}
+	for (int rank = 0; rank < ranks; ++rank) {
+		fprintf(json, "%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"rank %d\"}}",
+			(rank > 0) ? ",\n" : "", rank, rank);
+	}
+
+	for (size_t i = 0; i < records.size(); ++i) {
+		const TraceRecord &record = records[i];
+		fprintf(json, "%s{\"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, ",
+			(i > 0 || ranks > 0) ? ",\n" : "", traceKindName(record.kind), record.rank, record.thread,
+			record.begin * 1e6, (record.end - record.begin) * 1e6);
+		if (record.kind == TRACE_BLOCK) {
+			fprintf(json, "\"name\": \"block %d,%d\", \"args\": {\"bx\": %d, \"by\": %d, \"step\": %d}}",
+				record.bx, record.by, record.bx, record.by, record.step);
+		} else if (record.kind == TRACE_WAIT) {
+			fprintf(json, "\"name\": \"halo wait\", \"args\": {\"step\": %d}}", record.step);
+		} else {
+			fprintf(json, "\"name\": \"%s %s\", \"args\": {\"slot\": %d, \"step\": %d}}",
+				traceKindName(record.kind), traceEdgeName(record.bx), record.by, record.step);
+		}
+	}
+	fprintf(json, "\n]}\n");
+	fclose(json);
+
+	FILE *csv = openTraceFile(name + ".csv");
+	fprintf(csv, "rank,thread,kind,bx,by,step,begin,end\n");
+	for (const TraceRecord &record : records) {
+		fprintf(csv, "%d,%d,%s,%d,%d,%d,%.6f,%.6f\n", record.rank, record.thread, traceKindName(record.kind),
+			record.bx, record.by, record.step, record.begin, record.end);
+	}
+	fclose(csv);
+}
+
+#endif // TRACE_HPP
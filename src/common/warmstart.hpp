@@ -0,0 +1,229 @@
+#ifndef WARMSTART_HPP
+#define WARMSTART_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "common/field.hpp"
+#include "common/heat.hpp"
+
+// Initial guess (-g). The grid starts from these values instead of zero, so
+// that the sweeps need not carry the heat in from the boundary again:
+//  - FILE: the field file (-F) of a previous solve, interpolated bilinearly
+//    when its grid has another size. Each process only reads the blocks of
+//    the file under its tile.
+//  - coarse[:F]: the grid coarsened F times in each dimension, solved by
+//    nested iteration and interpolated bilinearly. The coarse grid is the
+//    last of a hierarchy of grids that double from a few cells; each level
+//    starts from the interpolation of the one before and runs SOR sweeps.
+//    Every process solves the whole coarse grid, which needs no messages.
+
+// Largest dimension of the first level of the coarse solve
+#define GUESS_FIRST_LEVEL 8
+
+// SOR sweeps of each level of the coarse solve
+#define GUESS_SWEEPS 64
+
+// Values on a cell-centered rows x cols grid over the whole domain, of which
+// the windowRows x windowCols cells from (row0, col0) are held
+struct GuessGrid {
+	int rows;
+	int cols;
+	int row0;
+	int col0;
+	int windowRows;
+	int windowCols;
+	std::vector<double> values;
+
+	double &at(int x, int y) { return values[(size_t) (x - row0) * windowCols + (y - col0)]; }
+	double at(int x, int y) const { return values[(size_t) (x - row0) * windowCols + (y - col0)]; }
+};
+
+// Position, in the cells of a grid of m cells, of the center of cell x of a
+// grid of n cells over the same domain, clamped to the outer cell centers
+inline double guessCoordinate(int x, int n, int m)
+{
+	return std::min(std::max((x + 0.5) * m / n - 0.5, 0.0), m - 1.0);
+}
+
+// Bilinear value of the guess at cell (x, y) of a rows x cols grid. A guess
+// of the same size gives its values unchanged.
+inline double interpolateGuess(const GuessGrid &guess, int x, int y, int rows, int cols)
+{
+	const double sx = guessCoordinate(x, rows, guess.rows);
+	const double sy = guessCoordinate(y, cols, guess.cols);
+	const int x0 = (int) sx;
+	const int y0 = (int) sy;
+	const int x1 = std::min(x0 + 1, guess.rows - 1);
+	const int y1 = std::min(y0 + 1, guess.cols - 1);
+	const double fx = sx - x0;
+	const double fy = sy - y0;
+
+	return (1.0 - fx) * ((1.0 - fy) * guess.at(x0, y0) + fy * guess.at(x0, y1))
+		+ fx * ((1.0 - fy) * guess.at(x1, y0) + fy * guess.at(x1, y1));
+}
+
+// Window of a grid of m cells that the cells [begin, end) of a grid of n
+// cells interpolate from
+inline void guessWindow(int begin, int end, int n, int m, int &first, int &count)
+{
+	first = (int) guessCoordinate(begin, n, m);
+	count = std::min((int) guessCoordinate(end - 1, n, m) + 1, m - 1) - first + 1;
+}
+
+// The part of the field file that the cells [rowBegin, rowEnd) x [colBegin,
+// colEnd) of the grid interpolate from
+inline GuessGrid readGuessField(const HeatConfiguration &conf, int rowBegin, int rowEnd, int colBegin, int colEnd)
+{
+	FieldFile field = openFieldFile(conf.guessFileName);
+
+	GuessGrid guess;
+	guess.rows = field.header.rows;
+	guess.cols = field.header.cols;
+	guessWindow(rowBegin, rowEnd, conf.rows, guess.rows, guess.row0, guess.windowRows);
+	guessWindow(colBegin, colEnd, conf.cols, guess.cols, guess.col0, guess.windowCols);
+	guess.values.resize((size_t) guess.windowRows * guess.windowCols);
+
+	if (field.header.valueSize == sizeof(float)) {
+		readFieldRegion<float>(field, guess.row0, guess.col0, guess.windowRows, guess.windowCols, guess.values.data());
+	} else {
+		readFieldRegion<double>(field, guess.row0, guess.col0, guess.windowRows, guess.windowCols, guess.values.data());
+	}
+
+	closeFieldFile(field);
+	return guess;
+}
+
+// Level of the coarse solve: its cells, the averages of the boundary along
+// its top, bottom, left and right sides, and the grid cells per level cell
+// vertically and horizontally
+struct GuessLevel {
+	GuessGrid grid;
+	std::vector<double> boundary[4];
+	double h[2];
+};
+
+// Average the boundary cells of a side of length cells over n level cells
+inline void averageBoundary(const std::vector<real_t> &boundary, int n, std::vector<double> &level)
+{
+	const int length = boundary.size();
+	level.assign(n, 0.0);
+	for (int k = 0; k < n; ++k) {
+		const int begin = (long) k * length / n;
+		const int end = (long) (k + 1) * length / n;
+		for (int i = begin; i < end; ++i) {
+			level[k] += boundary[i];
+		}
+		level[k] /= (end - begin);
+	}
+}
+
+inline void createGuessLevel(const HeatConfiguration &conf, const std::vector<real_t> boundary[4], int rows, int cols, GuessLevel &level)
+{
+	GuessGrid &grid = level.grid;
+	grid.rows = grid.windowRows = rows;
+	grid.cols = grid.windowCols = cols;
+	grid.row0 = grid.col0 = 0;
+	grid.values.assign((size_t) rows * cols, 0.0);
+
+	averageBoundary(boundary[0], cols, level.boundary[0]);
+	averageBoundary(boundary[1], cols, level.boundary[1]);
+	averageBoundary(boundary[2], rows, level.boundary[2]);
+	averageBoundary(boundary[3], rows, level.boundary[3]);
+	level.h[0] = (double) conf.rows / rows;
+	level.h[1] = (double) conf.cols / cols;
+}
+
+// SOR sweeps of the 5-point Laplacian on a level. The boundary lies one grid
+// cell outside the grid, (h + 1) / 2h level cells from the outer centers;
+// the value beyond an outer cell is extrapolated from the cell and the
+// boundary, and folded into the diagonal.
+inline void smoothGuessLevel(GuessLevel &level, int sweeps)
+{
+	GuessGrid &grid = level.grid;
+	const int rows = grid.rows;
+	const int cols = grid.cols;
+
+	// Weights of the vertical and horizontal neighbours, whose distances
+	// differ when the level cells are not square
+	const double ax = 1.0 / (level.h[0] * level.h[0]);
+	const double ay = 1.0 / (level.h[1] * level.h[1]);
+	const double wx = 2.0 * level.h[0] / (level.h[0] + 1.0);
+	const double wy = 2.0 * level.h[1] / (level.h[1] + 1.0);
+	const double omega = 2.0 / (1.0 + sin(M_PI / (std::max(rows, cols) + 1)));
+
+	for (int s = 0; s < sweeps; ++s) {
+		for (int x = 0; x < rows; ++x) {
+			for (int y = 0; y < cols; ++y) {
+				double sum = 0.0;
+				double diagonal = 2.0 * ax + 2.0 * ay;
+				if (x > 0)      sum += ax * grid.at(x-1, y);
+				else            { sum += ax * wx * level.boundary[0][y]; diagonal -= ax * (1.0 - wx); }
+				if (x < rows-1) sum += ax * grid.at(x+1, y);
+				else            { sum += ax * wx * level.boundary[1][y]; diagonal -= ax * (1.0 - wx); }
+				if (y > 0)      sum += ay * grid.at(x, y-1);
+				else            { sum += ay * wy * level.boundary[2][x]; diagonal -= ay * (1.0 - wy); }
+				if (y < cols-1) sum += ay * grid.at(x, y+1);
+				else            { sum += ay * wy * level.boundary[3][x]; diagonal -= ay * (1.0 - wy); }
+
+				double &value = grid.at(x, y);
+				value += omega * (sum / diagonal - value);
+			}
+		}
+	}
+}
+
+// Solve the grid coarsened conf.guessCoarsening times
+inline GuessGrid solveCoarseGuess(const HeatConfiguration &conf)
+{
+	std::vector<real_t> boundary[4];
+	gridBoundary(conf, conf.step, boundary);
+
+	// Halve the coarse grid down to the first level
+	std::vector<int> rows(1, (conf.rows + conf.guessCoarsening - 1) / conf.guessCoarsening);
+	std::vector<int> cols(1, (conf.cols + conf.guessCoarsening - 1) / conf.guessCoarsening);
+	while (std::max(rows.back(), cols.back()) > GUESS_FIRST_LEVEL) {
+		rows.push_back((rows.back() + 1) / 2);
+		cols.push_back((cols.back() + 1) / 2);
+	}
+
+	GuessGrid previous;
+	for (int l = rows.size() - 1; l >= 0; --l) {
+		GuessLevel level;
+		createGuessLevel(conf, boundary, rows[l], cols[l], level);
+		if (l < (int) rows.size() - 1) {
+			for (int x = 0; x < rows[l]; ++x) {
+				for (int y = 0; y < cols[l]; ++y) {
+					level.grid.at(x, y) = interpolateGuess(previous, x, y, rows[l], cols[l]);
+				}
+			}
+		}
+		smoothGuessLevel(level, GUESS_SWEEPS);
+		previous.values.swap(level.grid.values);
+		previous.rows = previous.windowRows = rows[l];
+		previous.cols = previous.windowCols = cols[l];
+		previous.row0 = previous.col0 = 0;
+	}
+	return previous;
+}
+
+// Set the cells of a tile of rowBlocks x colBlocks blocks, which starts at
+// (conf.rowOffset, conf.colOffset) of the grid, to the initial guess
+inline void initializeGuess(const HeatConfiguration &conf, block_t *matrix, int rowBlocks, int colBlocks)
+{
+	const int numRows = std::min(rowBlocks * BSX, conf.rows - conf.rowOffset);
+	const int numCols = std::min(colBlocks * BSY, conf.cols - conf.colOffset);
+
+	const GuessGrid guess = (conf.initialGuess == GUESS_FIELD)
+		? readGuessField(conf, conf.rowOffset, conf.rowOffset + numRows, conf.colOffset, conf.colOffset + numCols)
+		: solveCoarseGuess(conf);
+
+	traverseByRows(matrix, rowBlocks, colBlocks, numRows, numCols,
+		[&](int x, int y, real_t &value) {
+			value = interpolateGuess(guess, conf.rowOffset + x, conf.colOffset + y, conf.rows, conf.cols);
+		}
+	);
+}
+
+#endif // WARMSTART_HPP
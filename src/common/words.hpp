@@ -0,0 +1,119 @@
+#ifndef WORDS_HPP
+#define WORDS_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Lossless coder of the halo messages (-z) and of the field tiles (-F). The
+// words of a message are XORed with previous ones, which both ends keep, and
+// the words of the result are coded as runs of zero words or as their
+// non-zero low bytes:
+//
+//   0x80 | (n-1)        n (1..128) words equal to the previous ones
+//   k, bytes[W-k]       a word with k leading zero bytes (W bytes per word)
+//
+// The first byte of a message tells whether it is coded (1) or raw (0): a
+// message that would not shrink is kept raw. The coder is templated on the
+// value type, so that tools can read the files of any precision.
+
+// Values are coded as unsigned words of their size
+template <typename Real>
+using word_t = typename std::conditional<sizeof(Real) == 4, uint32_t, uint64_t>::type;
+
+// Largest message of count values
+template <typename Real>
+inline int codedMessageSize(int count)
+{
+	return 1 + count * sizeof(word_t<Real>);
+}
+
+// Code the values into buffer against previous, which becomes the values.
+// Returns the message size.
+template <typename Real>
+inline int encodeWords(const Real *values, word_t<Real> *previous, int count, unsigned char *buffer)
+{
+	typedef word_t<Real> Word;
+	const int W = sizeof(Word);
+	const int limit = codedMessageSize<Real>(count);
+	int size = 1;
+	buffer[0] = 1;
+
+	for (int i = 0; i < count; ) {
+		Word word;
+		memcpy(&word, &values[i], W);
+		Word delta = word ^ previous[i];
+
+		if (delta == 0) {
+			int run = 1;
+			while (i + run < count && run < 128) {
+				Word next;
+				memcpy(&next, &values[i+run], W);
+				if (next != previous[i+run]) break;
+				++run;
+			}
+			if (size + 1 > limit) break;
+			buffer[size++] = 0x80 | (run - 1);
+			i += run;
+			continue;
+		}
+
+		int zeros = ((W == 8) ? __builtin_clzll((unsigned long long) delta) : __builtin_clz((unsigned int) delta)) / 8;
+		if (size + 1 + W - zeros > limit) {
+			size = limit + 1;
+			break;
+		}
+		buffer[size++] = zeros;
+		for (int b = 0; b < W - zeros; ++b) {
+			buffer[size++] = (unsigned char) (delta >> (8 * b));
+		}
+		previous[i] = word;
+		++i;
+	}
+
+	// Keep it raw if coding does not pay off
+	if (size >= limit) {
+		buffer[0] = 0;
+		memcpy(&buffer[1], values, count * W);
+		memcpy(previous, values, count * W);
+		return limit;
+	}
+	return size;
+}
+
+// Decode a message of count values against previous, which becomes the
+// values. Returns the message size.
+template <typename Real>
+inline int decodeWords(const unsigned char *buffer, word_t<Real> *previous, int count, Real *values)
+{
+	typedef word_t<Real> Word;
+	const int W = sizeof(Word);
+
+	if (buffer[0] == 0) {
+		memcpy(values, &buffer[1], count * W);
+		memcpy(previous, values, count * W);
+		return codedMessageSize<Real>(count);
+	}
+
+	const unsigned char *p = &buffer[1];
+	for (int i = 0; i < count; ) {
+		unsigned char token = *p++;
+		if (token & 0x80) {
+			for (int run = (token & 0x7f) + 1; run > 0; --run, ++i) {
+				memcpy(&values[i], &previous[i], W);
+			}
+			continue;
+		}
+
+		Word delta = 0;
+		for (int b = 0; b < W - token; ++b) {
+			delta |= (Word) *p++ << (8 * b);
+		}
+		previous[i] ^= delta;
+		memcpy(&values[i], &previous[i], W);
+		++i;
+	}
+	return p - buffer;
+}
+
+#endif // WORDS_HPP
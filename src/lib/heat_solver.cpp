@@ -0,0 +1,245 @@
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+#include "common/heat.hpp"
+#include "common/activity.hpp"
+#include "lib/heat_solver.hpp"
+
+struct HeatSolverState {
+	HeatConfiguration conf;
+	int rowBlocks;
+	int colBlocks;
+};
+
+// Same choices and checks as the command-line options
+static void applyOptions(HeatConfiguration &conf, const HeatSolverOptions &options)
+{
+	if (options.solver == "gs") {
+		conf.solver = GAUSS_SEIDEL;
+	} else if (options.solver == "mg") {
+		conf.solver = MULTIGRID;
+	} else if (options.solver == "jacobi") {
+		conf.solver = JACOBI;
+	} else {
+		fprintf(stderr, "Error: Unknown solver %s!\n", options.solver.c_str());
+		exit(1);
+	}
+
+	if (options.omega < 0.0 || options.omega >= 2.0) {
+		fprintf(stderr, "Error: The relaxation factor must be in (0, 2)!\n");
+		exit(1);
+	}
+	conf.omega = options.omega;
+
+	if (options.mgCycle == "v") {
+		conf.mgCycle = 1;
+	} else if (options.mgCycle == "w") {
+		conf.mgCycle = 2;
+	} else {
+		fprintf(stderr, "Error: Unknown multigrid cycle %s!\n", options.mgCycle.c_str());
+		exit(1);
+	}
+
+	if (options.activeTolerance < 0.0) {
+		fprintf(stderr, "Error: The active-block tolerance must not be negative!\n");
+		exit(1);
+	}
+	conf.activeBlocks = options.activeBlocks;
+	conf.activeTolerance = options.activeTolerance;
+	conf.paddedBlocks = options.paddedBlocks;
+
+	if (options.superBlocks < 1) {
+		fprintf(stderr, "Error: The super-block size must be positive!\n");
+		exit(1);
+	}
+	conf.superBlocks = options.superBlocks;
+
+	if (!std::is_same<Stencil, FivePointStencil>::value && (conf.solver != GAUSS_SEIDEL || conf.paddedBlocks)) {
+		fprintf(stderr, "Error: The %s stencil is only available in the Gauss-Seidel sweeps!\n", Stencil::name());
+		exit(1);
+	}
+}
+
+// The activity tracking assumes that unchanged blocks keep their values, so
+// any change of the boundaries makes every block active again
+static void activateAllBlocks(HeatSolverState &state)
+{
+	if (state.conf.blockChange == nullptr) return;
+	for (int b = 0; b < state.rowBlocks * state.colBlocks; ++b) {
+		state.conf.blockChange[b] = HUGE_VAL;
+	}
+}
+
+// Boundaries of the heat sources at the current step
+static void resetHalos(HeatSolverState &state)
+{
+	HeatConfiguration &conf = state.conf;
+
+	// The sources are accumulated on the halos
+	memset(conf.halos_row[top],    0, state.colBlocks * sizeof(row_t));
+	memset(conf.halos_row[bottom], 0, state.colBlocks * sizeof(row_t));
+	memset(conf.halos_col[left],   0, state.rowBlocks * sizeof(col_t));
+	memset(conf.halos_col[right],  0, state.rowBlocks * sizeof(col_t));
+	initializeHalos(conf, conf.matrix, state.rowBlocks, state.colBlocks);
+}
+
+HeatSolver::HeatSolver(int rows, int cols, const HeatSolverOptions &options) :
+	state(new HeatSolverState)
+{
+	HeatConfiguration &conf = state->conf;
+	if (rows <= 0 || cols <= 0) {
+		fprintf(stderr, "Error: The grid must have at least one row and one column!\n");
+		exit(1);
+	}
+	conf.rows = rows;
+	conf.cols = cols;
+	conf.timesteps = 1;
+	applyOptions(conf, options);
+
+	refineConfiguration(conf, 1, 1, true);
+	decomposeConfiguration(conf, ProcessLayout(0, 0), state->rowBlocks, state->colBlocks);
+
+	int err = initialize(conf, state->rowBlocks, state->colBlocks);
+	assert(!err);
+}
+
+HeatSolver::~HeatSolver()
+{
+	finalize(state->conf);
+	free(state->conf.heatSources);
+}
+
+int HeatSolver::rows() const
+{
+	return state->conf.rows;
+}
+
+int HeatSolver::cols() const
+{
+	return state->conf.cols;
+}
+
+const char *HeatSolver::backend()
+{
+#ifdef _OMPSS_2
+	return "ompss";
+#else
+	return "seq";
+#endif
+}
+
+int HeatSolver::blockRows()
+{
+	return BSX;
+}
+
+int HeatSolver::blockCols()
+{
+	return BSY;
+}
+
+const char *HeatSolver::blockOrder()
+{
+#if HEAT_BLOCK_ORDER == HEAT_ORDER_MORTON
+	return "morton";
+#elif HEAT_BLOCK_ORDER == HEAT_ORDER_HILBERT
+	return "hilbert";
+#else
+	return "rows";
+#endif
+}
+
+void HeatSolver::setBoundary(HeatBoundary boundary, const double *values)
+{
+	HeatConfiguration &conf = state->conf;
+	auto set = [&](int x, int y, real_t &value) {
+		value = values[(boundary == HEAT_TOP || boundary == HEAT_BOTTOM) ? y : x];
+	};
+
+	switch (boundary) {
+		case HEAT_TOP:
+			traverseRowHalo(conf.halos_row[top], 0, 0, conf.cols, set);
+			break;
+		case HEAT_BOTTOM:
+			traverseRowHalo(conf.halos_row[bottom], conf.rows, 0, conf.cols, set);
+			break;
+		case HEAT_LEFT:
+			traverseColHalo(conf.halos_col[left], 0, 0, conf.rows, set);
+			break;
+		case HEAT_RIGHT:
+			traverseColHalo(conf.halos_col[right], conf.cols, 0, conf.rows, set);
+			break;
+	}
+
+	activateAllBlocks(*state);
+}
+
+void HeatSolver::loadHeatSources(const std::string &fileName)
+{
+	HeatConfiguration &conf = state->conf;
+	const ProcessLayout layout = conf.processLayout;
+
+	free(conf.heatSources);
+	conf.heatSources = nullptr;
+	conf.confFileName = fileName;
+	readSourcesFile(conf);
+	conf.processLayout = layout;
+
+	resetHalos(*state);
+	activateAllBlocks(*state);
+}
+
+void HeatSolver::reset()
+{
+	HeatConfiguration &conf = state->conf;
+	initializeMatrix(conf, conf.matrix, state->rowBlocks, state->colBlocks);
+	conf.paddedCurrent = false;
+
+	// Time-dependent sources start over
+	const bool scheduled = (conf.step != 0 && !conf.keyframes.empty());
+	conf.step = 0;
+	if (scheduled) {
+		resetHalos(*state);
+	}
+
+	if (conf.blockChange != nullptr) {
+		initializeActivity(conf, conf.blockChange, state->rowBlocks, state->colBlocks, ProcessLayout(0, 0));
+	}
+}
+
+double HeatSolver::solve(int timesteps)
+{
+	HeatConfiguration &conf = state->conf;
+	if (timesteps <= 0) return 0.0;
+
+	conf.timesteps = timesteps;
+	return ::solve(conf.matrix, state->rowBlocks, state->colBlocks, conf, conf.halos_row, conf.halos_col);
+}
+
+void HeatSolver::getGrid(double *values) const
+{
+	const HeatConfiguration &conf = state->conf;
+	traverseByRows(conf.matrix, state->rowBlocks, state->colBlocks, conf.rows, conf.cols,
+		[&](int x, int y, double value) {
+			values[(long) x * conf.cols + y] = value;
+		}
+	);
+}
+
+double HeatSolver::getValue(int row, int col) const
+{
+	const HeatConfiguration &conf = state->conf;
+	assert(row >= 0 && row < conf.rows);
+	assert(col >= 0 && col < conf.cols);
+	return conf.matrix[blockIndex(row / BSX, col / BSY, state->rowBlocks, state->colBlocks)][row % BSX][col % BSY];
+}
+
+void HeatSolver::writeImage(const std::string &fileName) const
+{
+	const HeatConfiguration &conf = state->conf;
+	::writeImage(fileName, conf.matrix, state->rowBlocks, state->colBlocks, conf.rows, conf.cols);
+}
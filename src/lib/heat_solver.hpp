@@ -0,0 +1,91 @@
+#ifndef HEAT_SOLVER_HPP
+#define HEAT_SOLVER_HPP
+
+#include <memory>
+#include <string>
+
+// Library entry point of the heat solvers. Each libheat library is built for
+// one backend (libheat_seq or libheat_ompss), block size, storage precision
+// and block order, like the heat_* binaries; this header does not depend on
+// any of them, so applications only choose the library they link.
+//
+// A HeatSolver allocates its grid once. Boundaries can be replaced and the
+// grid reset between solves without reallocating, so one solver can run many
+// scenarios of the same size in one process.
+
+struct HeatSolverOptions {
+	std::string solver;      // "gs", "jacobi" or "mg", as in the -m option
+	double omega;            // relaxation factor in (0, 2), or 0 for the optimal one
+	std::string mgCycle;     // "v" or "w"
+	bool activeBlocks;       // skip the Gauss-Seidel blocks that cannot change
+	double activeTolerance;
+	bool paddedBlocks;       // run the Gauss-Seidel sweeps on padded blocks
+	int superBlocks;         // group the block tasks into KxK outer tasks (libheat_ompss)
+
+	HeatSolverOptions() :
+		solver("gs"),
+		omega(1.0),
+		mgCycle("v"),
+		activeBlocks(false),
+		activeTolerance(0.0),
+		paddedBlocks(false),
+		superBlocks(1)
+	{
+	}
+};
+
+enum HeatBoundary {
+	HEAT_TOP,
+	HEAT_BOTTOM,
+	HEAT_LEFT,
+	HEAT_RIGHT
+};
+
+struct HeatSolverState;
+
+class HeatSolver {
+public:
+	HeatSolver(int rows, int cols, const HeatSolverOptions &options = HeatSolverOptions());
+	~HeatSolver();
+
+	HeatSolver(const HeatSolver &) = delete;
+	HeatSolver &operator=(const HeatSolver &) = delete;
+
+	int rows() const;
+	int cols() const;
+
+	// Backend and compile-time layout of the linked library
+	static const char *backend();
+	static int blockRows();
+	static int blockCols();
+	static const char *blockOrder();
+
+	// Set the fixed temperatures around the grid: cols values for the top
+	// and bottom boundaries, rows values for the left and right ones. All
+	// boundaries start at zero.
+	void setBoundary(HeatBoundary boundary, const double *values);
+
+	// Set the boundaries from the heat sources of a heat.conf-style file
+	// (the process layout line is ignored). Sources with keyframes update
+	// the boundaries as the solves advance.
+	void loadHeatSources(const std::string &fileName);
+
+	// Set every grid cell back to zero, keeping the boundaries; time-dependent
+	// sources go back to their initial values
+	void reset();
+
+	// Run timesteps sweeps (or multigrid cycles) from the current grid and
+	// return the residual of the last one where the backend computes it
+	double solve(int timesteps);
+
+	// Copy the grid, row by row, to rows x cols values
+	void getGrid(double *values) const;
+	double getValue(int row, int col) const;
+
+	void writeImage(const std::string &fileName) const;
+
+private:
+	std::unique_ptr<HeatSolverState> state;
+};
+
+#endif // HEAT_SOLVER_HPP
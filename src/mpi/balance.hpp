@@ -0,0 +1,359 @@
+#ifndef BALANCE_HPP
+#define BALANCE_HPP
+
+#include <mpi.h>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "common/heat.hpp"
+#include "mpi/exchange.hpp"
+
+// Dynamic load balancing. Every rank accumulates the time spent updating each
+// of its blocks in conf.blockTime. After each rebalance interval the ranks
+// share their busy times and the boundaries between neighbouring process rows
+// (columns) move so that each one gets a number of block rows (columns)
+// proportional to its measured speed. A boundary never moves past the next
+// one, so blocks only travel between neighbouring ranks.
+
+// Rebalance only when the slowest rank is this much slower than the average
+#define BALANCE_TOLERANCE 1.05
+
+// and when the new tiles are predicted to divide that imbalance by at least
+// this much. Otherwise measurement noise and rounding to whole blocks move a
+// boundary back and forth between the same positions.
+#define BALANCE_MIN_GAIN 1.02
+
+// Tile of a rank in global block coordinates
+struct BlockTile {
+	int rowBegin, rowEnd;
+	int colBegin, colEnd;
+
+	int cols() const { return colEnd - colBegin; }
+	int blocks() const { return (rowEnd - rowBegin) * cols(); }
+	int index(int gbx, int gby) const { return blockIndex(gbx - rowBegin, gby - colBegin, rowEnd - rowBegin, cols()); }
+};
+
+inline BlockTile getTile(const HeatConfiguration &conf, ProcessLayout r)
+{
+	return BlockTile{conf.rowSplit[r.x], conf.rowSplit[r.x+1], conf.colSplit[r.y], conf.colSplit[r.y+1]};
+}
+
+// Blocks [begin, end) of the tile along rows or columns (empty if end <= begin)
+inline BlockTile sliceTile(const BlockTile &tile, bool rows, int begin, int end)
+{
+	end = std::max(begin, end);
+	return rows ? BlockTile{begin, end, tile.colBegin, tile.colEnd}
+	            : BlockTile{tile.rowBegin, tile.rowEnd, begin, end};
+}
+
+// New boundaries of parts whose measured cost per block is cost[i]. Sizes are
+// proportional to the speed of each part, every part keeps at least one block
+// and each boundary stays between its neighbouring old boundaries.
+inline std::vector<int> balanceSplit(const std::vector<int> &split, const std::vector<double> &cost)
+{
+	const int parts = cost.size();
+	const int blocks = split[parts];
+
+	// Parts without measured work count as fast as the fastest one
+	double minCost = 0.0;
+	for (double c : cost) {
+		if (c > 0.0 && (minCost == 0.0 || c < minCost)) minCost = c;
+	}
+	if (minCost == 0.0) return split;
+
+	std::vector<double> speed(parts);
+	double totalSpeed = 0.0;
+	for (int i = 0; i < parts; ++i) {
+		speed[i] = 1.0 / std::max(cost[i], minCost);
+		totalSpeed += speed[i];
+	}
+
+	std::vector<int> result(split);
+	double accumulated = 0.0;
+	for (int i = 1; i < parts; ++i) {
+		accumulated += speed[i-1];
+		int target = (int) std::lround(blocks * accumulated / totalSpeed);
+		target = std::max(target, split[i-1] + 1);
+		target = std::min(target, split[i+1] - 1);
+		result[i] = std::max(target, result[i-1] + 1);
+	}
+	return result;
+}
+
+// Ratio between the largest and the smallest cost (1 for a single part)
+inline double costSpread(const std::vector<double> &cost)
+{
+	double minCost = *std::min_element(cost.begin(), cost.end());
+	double maxCost = *std::max_element(cost.begin(), cost.end());
+	return (minCost > 0.0) ? maxCost / minCost : ((maxCost > 0.0) ? HUGE_VAL : 1.0);
+}
+
+// Imbalance of the busy times the ranks would have with the boundaries
+// newRowSplit and newColSplit, assuming each rank keeps its cost per block
+inline double predictImbalance(const HeatConfiguration &conf, const std::vector<double> &times, const std::vector<int> &newRowSplit, const std::vector<int> &newColSplit)
+{
+	double maxTime = 0.0, meanTime = 0.0;
+	for (int i = 0; i < conf.processLayout.x; ++i) {
+		for (int j = 0; j < conf.processLayout.y; ++j) {
+			const double oldBlocks = (conf.rowSplit[i+1] - conf.rowSplit[i]) * (conf.colSplit[j+1] - conf.colSplit[j]);
+			const double newBlocks = (newRowSplit[i+1] - newRowSplit[i]) * (newColSplit[j+1] - newColSplit[j]);
+			const double t = times[i * conf.processLayout.y + j] * newBlocks / oldBlocks;
+			maxTime = std::max(maxTime, t);
+			meanTime += t / times.size();
+		}
+	}
+	return (meanTime > 0.0) ? maxTime / meanTime : 1.0;
+}
+
+// Copy the blocks of region between an array ordered as tile and a packed buffer
+template <typename T>
+inline void copyRegion(T *data, const BlockTile &tile, T *packed, const BlockTile &region, bool pack)
+{
+	int k = 0;
+	for (int gbx = region.rowBegin; gbx < region.rowEnd; ++gbx) {
+		for (int gby = region.colBegin; gby < region.colEnd; ++gby, ++k) {
+			if (pack) {
+				memcpy(&packed[k], &data[tile.index(gbx, gby)], sizeof(T));
+			} else {
+				memcpy(&data[tile.index(gbx, gby)], &packed[k], sizeof(T));
+			}
+		}
+	}
+}
+
+// Redistribute per-block data from oldTile to newTile along rows or columns.
+// The blocks before (after) the new tile come from or go to the neighbour
+// lowRank (highRank). Returns the array of the new tile; the old one is freed.
+template <typename T>
+inline T *migrateBlocks(T *data, const BlockTile &oldTile, const BlockTile &newTile, bool rows, int lowRank, int highRank, int tag)
+{
+	T *result = (T *) malloc(newTile.blocks() * sizeof(T));
+	if (result == NULL) {
+		fprintf(stderr, "Error: Memory cannot be allocated!\n");
+		exit(1);
+	}
+
+	const int oldBegin = rows ? oldTile.rowBegin : oldTile.colBegin;
+	const int oldEnd   = rows ? oldTile.rowEnd   : oldTile.colEnd;
+	const int newBegin = rows ? newTile.rowBegin : newTile.colBegin;
+	const int newEnd   = rows ? newTile.rowEnd   : newTile.colEnd;
+
+	const BlockTile kept = sliceTile(oldTile, rows, std::max(oldBegin, newBegin), std::min(oldEnd, newEnd));
+	for (int gbx = kept.rowBegin; gbx < kept.rowEnd; ++gbx) {
+		for (int gby = kept.colBegin; gby < kept.colEnd; ++gby) {
+			memcpy(&result[newTile.index(gbx, gby)], &data[oldTile.index(gbx, gby)], sizeof(T));
+		}
+	}
+
+	const int neighbour[2] = {lowRank, highRank};
+	const BlockTile send[2] = {sliceTile(oldTile, rows, oldBegin, newBegin), sliceTile(oldTile, rows, newEnd, oldEnd)};
+	const BlockTile recv[2] = {sliceTile(newTile, rows, newBegin, oldBegin), sliceTile(newTile, rows, oldEnd, newEnd)};
+
+	MPI_Datatype blockType;
+	MPI_Type_contiguous(sizeof(T), MPI_BYTE, &blockType);
+	MPI_Type_commit(&blockType);
+
+	std::vector<MPI_Request> requests;
+	MPI_Request request;
+	T *sendBuffer[2] = {nullptr, nullptr};
+	T *recvBuffer[2] = {nullptr, nullptr};
+	for (int side = 0; side < 2; ++side) {
+		if (recv[side].blocks() > 0) {
+			recvBuffer[side] = (T *) malloc(recv[side].blocks() * sizeof(T));
+			assert(recvBuffer[side] != nullptr);
+			MPI_Irecv(recvBuffer[side], recv[side].blocks(), blockType, neighbour[side], tag, gridComm, &request);
+			requests.push_back(request);
+		}
+		if (send[side].blocks() > 0) {
+			sendBuffer[side] = (T *) malloc(send[side].blocks() * sizeof(T));
+			assert(sendBuffer[side] != nullptr);
+			copyRegion(data, oldTile, sendBuffer[side], send[side], true);
+			MPI_Isend(sendBuffer[side], send[side].blocks(), blockType, neighbour[side], tag, gridComm, &request);
+			requests.push_back(request);
+		}
+	}
+	waitAll(requests);
+
+	for (int side = 0; side < 2; ++side) {
+		if (recvBuffer[side] != nullptr) {
+			copyRegion(result, newTile, recvBuffer[side], recv[side], false);
+		}
+		free(sendBuffer[side]);
+		free(recvBuffer[side]);
+	}
+
+	MPI_Type_free(&blockType);
+	free(data);
+	return result;
+}
+
+// Move the blocks of this rank after the boundaries of the process rows or
+// columns change to newSplit
+inline void migrateTile(HeatConfiguration &conf, ProcessLayout rank2D, bool rows, const std::vector<int> &newSplit)
+{
+	const BlockTile oldTile = getTile(conf, rank2D);
+	(rows ? conf.rowSplit : conf.colSplit) = newSplit;
+	const BlockTile newTile = getTile(conf, rank2D);
+
+	const bool first = rows ? (rank2D.x == 0) : (rank2D.y == 0);
+	const bool last  = rows ? (rank2D.x == conf.processLayout.x-1) : (rank2D.y == conf.processLayout.y-1);
+	const int lowRank  = first ? MPI_PROC_NULL : (rows ? rank2D.getNorth(conf.processLayout) : rank2D.getEast(conf.processLayout));
+	const int highRank = last  ? MPI_PROC_NULL : (rows ? rank2D.getSouth(conf.processLayout) : rank2D.getWest(conf.processLayout));
+	const int tag = conf.rowBlocks + conf.colBlocks;
+
+	conf.matrix = migrateBlocks(conf.matrix, oldTile, newTile, rows, lowRank, highRank, tag);
+	if (conf.blockChange != nullptr) {
+		conf.blockChange = migrateBlocks(conf.blockChange, oldTile, newTile, rows, lowRank, highRank, tag);
+	}
+}
+
+// Rebuild the arrays that only depend on the shape of the tile
+inline void resizeTile(HeatConfiguration &conf, ProcessLayout rank2D, int rowBlocks, int colBlocks)
+{
+	for (int i = 0; i < 2; ++i) {
+		free(conf.halos_row[i]);
+		free(conf.halos_col[i]);
+		conf.halos_row[i] = (row_t *) calloc(HaloDepth * colBlocks, sizeof(row_t));
+		conf.halos_col[i] = (col_t *) calloc(HaloDepth * rowBlocks, sizeof(col_t));
+		if (conf.halos_row[i] == NULL || conf.halos_col[i] == NULL) {
+			fprintf(stderr, "Error: Memory cannot be allocated!\n");
+			exit(1);
+		}
+	}
+	initializeHalos(conf, conf.matrix, rowBlocks, colBlocks, rank2D);
+
+	storeLeftHalo(conf, rowBlocks, colBlocks, rank2D);
+
+	if (conf.nextMatrix != nullptr) {
+		free(conf.nextMatrix);
+		conf.nextMatrix = (block_t *) malloc(rowBlocks * colBlocks * sizeof(block_t));
+		if (conf.nextMatrix == NULL) {
+			fprintf(stderr, "Error: Memory cannot be allocated!\n");
+			exit(1);
+		}
+	}
+
+	free(conf.blockTime);
+	conf.blockTime = (double *) calloc(rowBlocks * colBlocks, sizeof(double));
+	if (conf.blockTime == NULL) {
+		fprintf(stderr, "Error: Memory cannot be allocated!\n");
+		exit(1);
+	}
+}
+
+// Last move of the boundaries, reported once the following interval has
+// measured its effect
+struct BalanceMove {
+	bool pending;
+	int step;
+	double imbalance;
+
+	BalanceMove() : pending(false), step(0), imbalance(0.0) {}
+};
+
+// Share the busy times of the last interval and measure their imbalance (the
+// slowest rank over the average). When move is set, the imbalance exceeds
+// the tolerance and the new tiles promise the minimum gain, the process row
+// and column boundaries move and the tiles are redistributed. A move is
+// printed by the next interval, with the imbalance before and after it and
+// the tiles it produced; an interval that neither follows nor makes a move
+// prints its imbalance and the tiles. Returns the imbalance.
+inline double rebalance(HeatConfiguration &conf, ProcessLayout rank2D, int &rowBlocks, int &colBlocks, int step, bool move, BalanceMove &last)
+{
+	int rank, rank_size;
+	MPI_Comm_rank(gridComm, &rank);
+	MPI_Comm_size(gridComm, &rank_size);
+
+	double busy = 0.0;
+	for (int b = 0; b < rowBlocks * colBlocks; ++b) {
+		busy += conf.blockTime[b];
+		conf.blockTime[b] = 0.0;
+	}
+
+	std::vector<double> times(rank_size);
+	MPI_Allgather(&busy, 1, MPI_DOUBLE, times.data(), 1, MPI_DOUBLE, gridComm);
+
+	double maxTime = 0.0, meanTime = 0.0;
+	for (double t : times) {
+		maxTime = std::max(maxTime, t);
+		meanTime += t / rank_size;
+	}
+	const double imbalance = (meanTime > 0.0) ? maxTime / meanTime : 1.0;
+
+	std::vector<int> newRowSplit(conf.rowSplit), newColSplit(conf.colSplit);
+	if (move && imbalance > BALANCE_TOLERANCE) {
+		// Cost per block row of each process row and per block column of
+		// each process column, set by their slowest rank
+		std::vector<double> rowCost(conf.processLayout.x, 0.0), colCost(conf.processLayout.y, 0.0);
+		for (int i = 0; i < conf.processLayout.x; ++i) {
+			for (int j = 0; j < conf.processLayout.y; ++j) {
+				double t = times[i * conf.processLayout.y + j];
+				rowCost[i] = std::max(rowCost[i], t / (conf.rowSplit[i+1] - conf.rowSplit[i]));
+				colCost[j] = std::max(colCost[j], t / (conf.colSplit[j+1] - conf.colSplit[j]));
+			}
+		}
+		// A rank's time depends on both of its extents, so moving both sets
+		// of boundaries at once overshoots: only the most uneven one moves
+		if (costSpread(rowCost) >= costSpread(colCost)) {
+			newRowSplit = balanceSplit(conf.rowSplit, rowCost);
+		} else {
+			newColSplit = balanceSplit(conf.colSplit, colCost);
+		}
+		if (imbalance < BALANCE_MIN_GAIN * predictImbalance(conf, times, newRowSplit, newColSplit)) {
+			newRowSplit = conf.rowSplit;
+			newColSplit = conf.colSplit;
+		}
+	}
+
+	const bool moving = (newRowSplit != conf.rowSplit || newColSplit != conf.colSplit);
+	if (!rank && (last.pending || !moving)) {
+		if (last.pending) {
+			fprintf(stdout, "rebalance, step, %d, imbalance, %f, after, %f, row_blocks,", last.step, last.imbalance, imbalance);
+		} else {
+			fprintf(stdout, "rebalance, step, %d, imbalance, %f, row_blocks,", step, imbalance);
+		}
+		for (int i = 0; i < conf.processLayout.x; ++i) fprintf(stdout, " %d", conf.rowSplit[i+1] - conf.rowSplit[i]);
+		fprintf(stdout, ", col_blocks,");
+		for (int j = 0; j < conf.processLayout.y; ++j) fprintf(stdout, " %d", conf.colSplit[j+1] - conf.colSplit[j]);
+		fprintf(stdout, "\n");
+	}
+
+	last.pending = moving;
+	last.step = step;
+	last.imbalance = imbalance;
+	if (!moving) {
+		return imbalance;
+	}
+
+	// Rows first, then columns of the new process rows
+	if (newRowSplit != conf.rowSplit) {
+		migrateTile(conf, rank2D, true, newRowSplit);
+	}
+	if (newColSplit != conf.colSplit) {
+		migrateTile(conf, rank2D, false, newColSplit);
+	}
+
+	decomposeConfiguration(conf, rank2D, rowBlocks, colBlocks);
+	resizeTile(conf, rank2D, rowBlocks, colBlocks);
+	return imbalance;
+}
+
+// Run the timesteps in rebalance intervals. The imbalance reported after an
+// interval is the one left by the previous rebalance.
+inline void solveBalanced(HeatConfiguration &conf, int &rowBlocks, int &colBlocks, ProcessLayout rank2D)
+{
+	const int timesteps = conf.timesteps;
+	BalanceMove last;
+	for (int t = 0; t < timesteps; t += conf.rebalanceInterval) {
+		conf.timesteps = std::min(conf.rebalanceInterval, timesteps - t);
+		solve(conf.matrix, rowBlocks, colBlocks, conf, conf.halos_row, conf.halos_col, rank2D);
+		rebalance(conf, rank2D, rowBlocks, colBlocks, t + conf.timesteps, t + conf.timesteps < timesteps, last);
+	}
+	conf.timesteps = timesteps;
+}
+
+#endif // BALANCE_HPP
@@ -0,0 +1,91 @@
+#ifndef BORDERS_HPP
+#define BORDERS_HPP
+
+#include "common/heat.hpp"
+#include "mpi/exchange.hpp"
+
+// Blocking transfers of the halo rows and columns of a Gauss-Seidel step, as
+// run by the pure MPI and MPI+OpenMP solvers and measured by bench_mpi. The
+// letters pair each send with the receive of the neighbouring rank.
+
+//A
+inline void sendFirstComputeRow(block_t *matrix, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
+{
+	for (int by = 0; by < nby; ++by) {
+		for (int d = 0; d < HaloDepth; ++d) {
+			sendHalo(matrix[blockIndex(0, by, nbx, nby)][d], BSY, rank2D.getNorth(conf.processLayout), haloDepthIndex(by, d), TOP_EDGE, haloDepthIndex(by, d), conf.step);
+		}
+	}
+}
+
+//A
+inline void receiveLowerBorder(row_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
+{
+	for (int by = 0; by < nby; ++by) {
+		for (int d = 0; d < HaloDepth; ++d) {
+			recvHalo(halo[d * nby + by], BSY, rank2D.getSouth(conf.processLayout), haloDepthIndex(by, d), BOTTOM_EDGE, haloDepthIndex(by, d), conf.step);
+		}
+	}
+}
+
+//B
+inline void sendLastComputeRow(block_t *matrix, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
+{
+	for (int by = 0; by < nby; ++by) {
+		for (int d = 0; d < HaloDepth; ++d) {
+			sendHalo(matrix[blockIndex(nbx-1, by, nbx, nby)][BSX-1-d], BSY, rank2D.getSouth(conf.processLayout), haloDepthIndex(by, d), BOTTOM_EDGE, haloDepthIndex(by, d), conf.step);
+		}
+	}
+}
+
+//B
+inline void receiveUpperBorder(row_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
+{
+	for (int by = 0; by < nby; ++by) {
+		for (int d = 0; d < HaloDepth; ++d) {
+			recvHalo(halo[d * nby + by], BSY, rank2D.getNorth(conf.processLayout), haloDepthIndex(by, d), TOP_EDGE, haloDepthIndex(by, d), conf.step);
+		}
+	}
+}
+
+//C
+inline void sendLeftBorder(col_t *halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
+{
+	for (int bx = 0; bx < nbx; ++bx) {
+		for (int d = 0; d < HaloDepth; ++d) {
+			sendHalo(halo[d * nbx + bx], BSX, rank2D.getEast(conf.processLayout), haloDepthIndex(bx+conf.colBlocks, d), LEFT_EDGE, haloDepthIndex(bx, d), conf.step);
+		}
+	}
+}
+
+//C
+inline void receiveRightBorder(col_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
+{
+	for (int bx = 0; bx < nbx; ++bx) {
+		for (int d = 0; d < HaloDepth; ++d) {
+			recvHalo(halo[d * nbx + bx], BSX, rank2D.getWest(conf.processLayout), haloDepthIndex(bx+conf.colBlocks, d), RIGHT_EDGE, haloDepthIndex(bx, d), conf.step);
+		}
+	}
+}
+
+//D
+inline void sendRightBorder(col_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
+{
+	for (int bx = 0; bx < nbx; ++bx) {
+		for (int d = 0; d < HaloDepth; ++d) {
+			sendHalo(halo[d * nbx + bx], BSX, rank2D.getWest(conf.processLayout), haloDepthIndex(bx+conf.colBlocks, d), RIGHT_EDGE, haloDepthIndex(bx, d), conf.step);
+		}
+	}
+}
+
+//D
+inline void receiveLeftBorder(col_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
+{
+	for (int bx = 0; bx < nbx; ++bx) {
+		for (int d = 0; d < HaloDepth; ++d) {
+			recvHalo(halo[d * nbx + bx], BSX, rank2D.getEast(conf.processLayout), haloDepthIndex(bx+conf.colBlocks, d), LEFT_EDGE, haloDepthIndex(bx, d), conf.step);
+		}
+	}
+}
+
+#endif // BORDERS_HPP
@@ -0,0 +1,271 @@
+#ifndef CODEC_HPP
+#define CODEC_HPP
+
+#include <mpi.h>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "common/heat.hpp"
+#include "common/trace.hpp"
+#include "common/words.hpp"
+
+// Communicator of the ranks that solve the grid (defined in main.cpp)
+extern MPI_Comm gridComm;
+
+// Lossless halo compression (-z). Every halo message of a block is coded
+// against the previous message of the same block and edge, which both ends
+// keep, with the word coder of common/words.hpp. Only the edges whose
+// neighbour runs on another node are compressed, unless every edge is
+// requested.
+enum HaloEdge {
+	TOP_EDGE,
+	BOTTOM_EDGE,
+	LEFT_EDGE,
+	RIGHT_EDGE,
+	NUM_EDGES
+};
+
+typedef word_t<real_t> halo_word_t;
+
+// Largest message of count values
+inline int haloMessageSize(int count)
+{
+	return codedMessageSize<real_t>(count);
+}
+
+// Last values of the messages of a block (zero at first) and the buffer of
+// its next message
+struct HaloSlot {
+	std::vector<halo_word_t> previous;
+	std::vector<unsigned char> buffer;
+};
+
+// Messages of one direction of an edge. The slots are allocated on first use
+// and never move, so tasks can code the messages of different blocks at once.
+struct HaloStream {
+	std::mutex lock;
+	std::vector<std::unique_ptr<HaloSlot> > slots;
+
+	HaloSlot &slot(int index, int count)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if ((int) slots.size() <= index) {
+			slots.resize(index + 1);
+		}
+		if (!slots[index]) {
+			slots[index].reset(new HaloSlot);
+			slots[index]->previous.assign(count, 0);
+			slots[index]->buffer.resize(haloMessageSize(count));
+		}
+		return *slots[index];
+	}
+};
+
+struct HaloEdgeCodec {
+	bool enabled = false;
+	HaloStream send;
+	HaloStream receive;
+
+	std::mutex lock;
+	long messages = 0;
+	double rawBytes = 0.0;
+	double codedBytes = 0.0;
+	double encodeTime = 0.0;
+	double decodeTime = 0.0;
+};
+
+// Received messages that are decoded once their requests complete
+struct PendingDecode {
+	HaloEdge edge;
+	int slot;
+	real_t *values;
+	int count;
+};
+
+struct HaloCodec {
+	HaloEdgeCodec edges[NUM_EDGES];
+	std::vector<PendingDecode> pending;
+};
+
+inline HaloCodec &haloCodec()
+{
+	static HaloCodec codec;
+	return codec;
+}
+
+inline bool haloCompressed(HaloEdge edge)
+{
+	return haloCodec().edges[edge].enabled;
+}
+
+inline void countHaloMessage(HaloEdge edge, int count, int size, double encode, double decode)
+{
+	HaloEdgeCodec &codec = haloCodec().edges[edge];
+	std::lock_guard<std::mutex> guard(codec.lock);
+	if (size > 0) {
+		codec.messages++;
+		codec.rawBytes += count * sizeof(real_t);
+		codec.codedBytes += size;
+	}
+	codec.encodeTime += encode;
+	codec.decodeTime += decode;
+}
+
+// Post the send of count values to dest. A compressed message is coded into
+// the buffer of its slot, which must not be reused before the request
+// completes.
+inline void isendHalo(const real_t *values, int count, int dest, int tag, HaloEdge edge, int slot, MPI_Request &request)
+{
+	if (!haloCompressed(edge)) {
+		MPI_Isend(values, count, HEAT_MPI_REAL, dest, tag, gridComm, &request);
+		return;
+	}
+
+	HaloSlot &message = haloCodec().edges[edge].send.slot(slot, count);
+	double start = get_time();
+	int size = encodeWords(values, message.previous.data(), count, message.buffer.data());
+	countHaloMessage(edge, count, size, get_time() - start, 0.0);
+	MPI_Isend(message.buffer.data(), size, MPI_BYTE, dest, tag, gridComm, &request);
+}
+
+// Buffer of the next compressed message of a slot
+inline unsigned char *haloReceiveBuffer(HaloEdge edge, int slot, int count)
+{
+	return haloCodec().edges[edge].receive.slot(slot, count).buffer.data();
+}
+
+// Decode the message received into the buffer of a slot
+inline void decodeHalo(HaloEdge edge, int slot, real_t *values, int count)
+{
+	HaloSlot &message = haloCodec().edges[edge].receive.slot(slot, count);
+	double start = get_time();
+	decodeWords(message.buffer.data(), message.previous.data(), count, values);
+	countHaloMessage(edge, count, 0, 0.0, get_time() - start);
+}
+
+// Post the receive of count values from source. Compressed messages are
+// decoded by waitHaloReceives.
+inline void irecvHalo(real_t *values, int count, int source, int tag, HaloEdge edge, int slot, MPI_Request &request)
+{
+	if (!haloCompressed(edge)) {
+		MPI_Irecv(values, count, HEAT_MPI_REAL, source, tag, gridComm, &request);
+		return;
+	}
+
+	unsigned char *buffer = haloReceiveBuffer(edge, slot, count);
+	MPI_Irecv(buffer, haloMessageSize(count), MPI_BYTE, source, tag, gridComm, &request);
+	haloCodec().pending.push_back(PendingDecode {edge, slot, values, count});
+}
+
+// Complete the receives of a step and decode the compressed halos
+inline void waitHaloReceives(std::vector<MPI_Request> &requests, int step)
+{
+	const double traced = traceBegin();
+	MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+	requests.clear();
+
+	std::vector<PendingDecode> &pending = haloCodec().pending;
+	for (const PendingDecode &message : pending) {
+		decodeHalo(message.edge, message.slot, message.values, message.count);
+	}
+	pending.clear();
+	traceEnd(TRACE_WAIT, -1, -1, step, traced);
+}
+
+inline void sendHalo(const real_t *values, int count, int dest, int tag, HaloEdge edge, int slot, int step)
+{
+	const double traced = traceBegin();
+	if (!haloCompressed(edge)) {
+		MPI_Send(values, count, HEAT_MPI_REAL, dest, tag, gridComm);
+	} else {
+		MPI_Request request;
+		isendHalo(values, count, dest, tag, edge, slot, request);
+		MPI_Wait(&request, MPI_STATUS_IGNORE);
+	}
+	traceEnd(TRACE_SEND, edge, slot, step, traced);
+}
+
+inline void recvHalo(real_t *values, int count, int source, int tag, HaloEdge edge, int slot, int step)
+{
+	const double traced = traceBegin();
+	if (!haloCompressed(edge)) {
+		MPI_Recv(values, count, HEAT_MPI_REAL, source, tag, gridComm, MPI_STATUS_IGNORE);
+	} else {
+		unsigned char *buffer = haloReceiveBuffer(edge, slot, count);
+		MPI_Recv(buffer, haloMessageSize(count), MPI_BYTE, source, tag, gridComm, MPI_STATUS_IGNORE);
+		decodeHalo(edge, slot, values, count);
+	}
+	traceEnd(TRACE_RECV, edge, slot, step, traced);
+}
+
+// Decide which edges of this rank are compressed. Both ends of an edge see
+// the same node ids, so they agree.
+inline void setupHaloCodec(HeatConfiguration &conf, ProcessLayout rank2D)
+{
+	HaloCodec &codec = haloCodec();
+	for (int e = 0; e < NUM_EDGES; ++e) {
+		codec.edges[e].enabled = false;
+	}
+	if (conf.haloCompression == COMPRESS_NONE) return;
+
+	int rank, size;
+	MPI_Comm_rank(gridComm, &rank);
+	MPI_Comm_size(gridComm, &size);
+
+	// Every rank of a node takes the rank of the first one as node id
+	MPI_Comm nodeComm;
+	MPI_Comm_split_type(gridComm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+	int node = rank;
+	MPI_Bcast(&node, 1, MPI_INT, 0, nodeComm);
+	MPI_Comm_free(&nodeComm);
+
+	std::vector<int> nodes(size);
+	MPI_Allgather(&node, 1, MPI_INT, nodes.data(), 1, MPI_INT, gridComm);
+
+	const bool all = (conf.haloCompression == COMPRESS_ALL);
+	if (rank2D.x != 0) {
+		codec.edges[TOP_EDGE].enabled = all || nodes[rank2D.getNorth(conf.processLayout)] != node;
+	}
+	if (rank2D.x != conf.processLayout.x-1) {
+		codec.edges[BOTTOM_EDGE].enabled = all || nodes[rank2D.getSouth(conf.processLayout)] != node;
+	}
+	if (rank2D.y != 0) {
+		codec.edges[LEFT_EDGE].enabled = all || nodes[rank2D.getEast(conf.processLayout)] != node;
+	}
+	if (rank2D.y != conf.processLayout.y-1) {
+		codec.edges[RIGHT_EDGE].enabled = all || nodes[rank2D.getWest(conf.processLayout)] != node;
+	}
+}
+
+// Print one line per edge with the totals of all ranks: the compression
+// ratio of the sent messages and the time spent coding them
+inline void printHaloCodecStats(const HeatConfiguration &conf)
+{
+	if (conf.haloCompression == COMPRESS_NONE) return;
+
+	static const char *names[NUM_EDGES] = {"top", "bottom", "left", "right"};
+	HaloCodec &codec = haloCodec();
+	double local[NUM_EDGES][5], total[NUM_EDGES][5];
+	for (int e = 0; e < NUM_EDGES; ++e) {
+		local[e][0] = codec.edges[e].messages;
+		local[e][1] = codec.edges[e].rawBytes;
+		local[e][2] = codec.edges[e].codedBytes;
+		local[e][3] = codec.edges[e].encodeTime;
+		local[e][4] = codec.edges[e].decodeTime;
+	}
+	MPI_Reduce(local, total, NUM_EDGES * 5, MPI_DOUBLE, MPI_SUM, 0, gridComm);
+
+	int rank;
+	MPI_Comm_rank(gridComm, &rank);
+	if (rank) return;
+
+	for (int e = 0; e < NUM_EDGES; ++e) {
+		if (total[e][0] == 0) continue;
+		fprintf(stdout, "halo codec, edge, %s, messages, %.0f, raw_bytes, %.0f, coded_bytes, %.0f, ratio, %f, encode_time, %f, decode_time, %f\n",
+				names[e], total[e][0], total[e][1], total[e][2], total[e][1] / total[e][2], total[e][3], total[e][4]);
+	}
+}
+
+#endif // CODEC_HPP
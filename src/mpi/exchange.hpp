@@ -0,0 +1,135 @@
+#ifndef EXCHANGE_HPP
+#define EXCHANGE_HPP
+
+#include <mpi.h>
+#include <vector>
+
+#include "common/heat.hpp"
+#include "common/stencil.hpp"
+#include "mpi/codec.hpp"
+
+// Communicator of the ranks that solve the grid: all ranks, or one rank per
+// case in ensemble mode (defined in main.cpp)
+extern MPI_Comm gridComm;
+
+// Blocks along the rank border read halos that are received every step
+inline bool isBorderBlock(int nbx, int nby, int bx, int by)
+{
+	return bx == 0 || bx == nbx-1 || by == 0 || by == nby-1;
+}
+
+// Halos that the stencil reads on each side of the tile: HaloDepth rows or
+// columns from a neighbouring rank, or the boundary
+inline HaloDepths haloDepths(ProcessLayout rank2D, const HeatConfiguration &conf)
+{
+	HaloDepths depths = BoundaryHalos;
+	if (rank2D.x != 0)                      depths.rows[top]    = HaloDepth;
+	if (rank2D.x != conf.processLayout.x-1) depths.rows[bottom] = HaloDepth;
+	if (rank2D.y != 0)                      depths.cols[left]   = HaloDepth;
+	if (rank2D.y != conf.processLayout.y-1) depths.cols[right]  = HaloDepth;
+	return depths;
+}
+
+// Tag and codec slot of depth d of the halo message with the given index
+inline int haloDepthIndex(int index, int d)
+{
+	return index * HaloDepth + d;
+}
+
+// The Gauss-Seidel sweeps send the first and last columns of the tile from
+// the side halos: once a block along a side has been updated, its columns
+// there replace the halo columns, which only that block reads
+inline void storeBorderColumns(const block_t *matrix, col_t ** halo_col, int nbx, int nby, int bx, int by, int nx, int ny,
+		ProcessLayout rank2D, const HeatConfiguration &conf)
+{
+	const block_t &block = matrix[blockIndex(bx, by, nbx, nby)];
+	for (int d = 0; d < HaloDepth; ++d) {
+		if (by == 0 && rank2D.y != 0) {
+			for (int x = 0; x < nx; ++x) {
+				halo_col[left][d * nbx + bx][x] = block[x][d];
+			}
+		}
+		if (by == nby-1 && rank2D.y != conf.processLayout.y-1) {
+			for (int x = 0; x < nx; ++x) {
+				halo_col[right][d * nbx + bx][x] = block[x][ny-1-d];
+			}
+		}
+	}
+}
+
+// The first Gauss-Seidel sweep sends the left halo before any block is
+// updated, so it must hold the first columns of the grid the tile starts from
+inline void storeLeftHalo(const HeatConfiguration &conf, int rowBlocks, int colBlocks, ProcessLayout rank2D)
+{
+	if (rank2D.y == 0) return;
+
+	for (int d = 0; d < HaloDepth; ++d) {
+		for (int bx = 0; bx < rowBlocks; ++bx) {
+			for (int x = 0; x < BSX; ++x) {
+				conf.halos_col[left][d * rowBlocks + bx][x] = conf.matrix[blockIndex(bx, 0, rowBlocks, colBlocks)][x][d];
+			}
+		}
+	}
+}
+
+// Post the whole halo exchange of a Jacobi step at once: the first/last rows
+// are sent straight from the grid and the first/last columns are packed into
+// sendCols. Nothing in the grid changes until the step ends, so the receives
+// only need to complete before the border blocks are computed, and the sends
+// before the grid is overwritten. Compressed halos are decoded when
+// waitHaloReceives completes the receives.
+inline void postHaloExchange(block_t *matrix, row_t ** halo_row, col_t ** halo_col, col_t ** sendCols, int nbx, int nby,
+		ProcessLayout rank2D, HeatConfiguration &conf, std::vector<MPI_Request> &recvs, std::vector<MPI_Request> &sends)
+{
+	MPI_Request request;
+
+	if (rank2D.x != 0) {
+		for (int by = 0; by < nby; ++by) {
+			irecvHalo(halo_row[top][by], BSY, rank2D.getNorth(conf.processLayout), by, TOP_EDGE, by, request);
+			recvs.push_back(request);
+			isendHalo(matrix[blockIndex(0, by, nbx, nby)][0], BSY, rank2D.getNorth(conf.processLayout), by, TOP_EDGE, by, request);
+			sends.push_back(request);
+		}
+	}
+
+	if (rank2D.x != conf.processLayout.x-1) {
+		for (int by = 0; by < nby; ++by) {
+			irecvHalo(halo_row[bottom][by], BSY, rank2D.getSouth(conf.processLayout), by, BOTTOM_EDGE, by, request);
+			recvs.push_back(request);
+			isendHalo(matrix[blockIndex(nbx-1, by, nbx, nby)][BSX-1], BSY, rank2D.getSouth(conf.processLayout), by, BOTTOM_EDGE, by, request);
+			sends.push_back(request);
+		}
+	}
+
+	if (rank2D.y != 0) {
+		for (int bx = 0; bx < nbx; ++bx) {
+			for (int x = 0; x < BSX; ++x) {
+				sendCols[left][bx][x] = matrix[blockIndex(bx, 0, nbx, nby)][x][0];
+			}
+			irecvHalo(halo_col[left][bx], BSX, rank2D.getEast(conf.processLayout), bx+conf.colBlocks, LEFT_EDGE, bx, request);
+			recvs.push_back(request);
+			isendHalo(sendCols[left][bx], BSX, rank2D.getEast(conf.processLayout), bx+conf.colBlocks, LEFT_EDGE, bx, request);
+			sends.push_back(request);
+		}
+	}
+
+	if (rank2D.y != conf.processLayout.y-1) {
+		for (int bx = 0; bx < nbx; ++bx) {
+			for (int x = 0; x < BSX; ++x) {
+				sendCols[right][bx][x] = matrix[blockIndex(bx, nby-1, nbx, nby)][x][BSY-1];
+			}
+			irecvHalo(halo_col[right][bx], BSX, rank2D.getWest(conf.processLayout), bx+conf.colBlocks, RIGHT_EDGE, bx, request);
+			recvs.push_back(request);
+			isendHalo(sendCols[right][bx], BSX, rank2D.getWest(conf.processLayout), bx+conf.colBlocks, RIGHT_EDGE, bx, request);
+			sends.push_back(request);
+		}
+	}
+}
+
+inline void waitAll(std::vector<MPI_Request> &requests)
+{
+	MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+	requests.clear();
+}
+
+#endif // EXCHANGE_HPP
@@ -1,13 +1,23 @@
 #include <mpi.h>
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <cstring>
+#include <vector>
 #include <math.h>
 
 #include "common/heat.hpp"
+#include "common/energy.hpp"
+#include "common/ensemble.hpp"
+#include "common/field.hpp"
+#include "common/trace.hpp"
+#include "mpi/balance.hpp"
+#include "mpi/codec.hpp"
 
 #ifdef _OMPSS_2
 #include <nanos6/debug.h>
+#elif defined(_OPENMP)
+#include <omp.h>
 #endif
 
 #ifdef INTEROPERABILITY
@@ -18,8 +28,176 @@
 
 #define isSingleProcess false
 
+MPI_Comm gridComm = MPI_COMM_WORLD;
+
 void generateImage(const HeatConfiguration &conf, int rowBlocks, int colBlocks, int rowBlocksPerRank, int colBlocksPerRank);
 
+static bool isFirstOnNode(int rank)
+{
+	MPI_Comm nodeComm;
+	MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+	int nodeRank;
+	MPI_Comm_rank(nodeComm, &nodeRank);
+	MPI_Comm_free(&nodeComm);
+	return nodeRank == 0;
+}
+
+// Rank 0 writes the trace records of every rank, each timed from the start
+// of the solve on its rank
+static void gatherTrace(const HeatConfiguration &conf, double start, int rank, int rank_size)
+{
+	std::vector<TraceRecord> records = collectTrace(start, rank);
+	int bytes = records.size() * sizeof(TraceRecord);
+
+	std::vector<int> counts(rank_size), displs(rank_size, 0);
+	MPI_Gather(&bytes, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+	for (int r = 1; r < rank_size; ++r) {
+		displs[r] = displs[r-1] + counts[r-1];
+	}
+
+	std::vector<TraceRecord> all(rank ? 0 : (displs[rank_size-1] + counts[rank_size-1]) / sizeof(TraceRecord));
+	MPI_Gatherv(records.data(), bytes, MPI_BYTE, all.data(), counts.data(), displs.data(), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+	if (!rank) {
+		std::stable_sort(all.begin(), all.end(), [](const TraceRecord &a, const TraceRecord &b) {
+			return a.begin < b.begin;
+		});
+		writeTrace(conf.traceFileName, all);
+	}
+}
+
+// Every rank writes the blocks of its tile to the field file with MPI-IO.
+// Raw blocks go to their place in row-major block order; the coded blocks of
+// a rank follow those of the lower ranks. Rank 0 writes the header and the
+// index, summed from the entries of every rank.
+static void writeFieldFile(const HeatConfiguration &conf, int rowBlocks, int colBlocks, int rank)
+{
+	const int rx = rank / conf.processLayout.y;
+	const int ry = rank % conf.processLayout.y;
+	const int tileRows = conf.rowSplit[rx+1] - conf.rowSplit[rx];
+	const int tileCols = conf.colSplit[ry+1] - conf.colSplit[ry];
+	const bool coded = conf.compressField;
+	const uint64_t dataOffset = fieldDataOffset(rowBlocks * colBlocks);
+
+	std::vector<unsigned char> buffer(coded ? tileRows * tileCols * codedTileSize<real_t>(BSX, BSY) : 0);
+	std::vector<uint64_t> sizes(tileRows * tileCols);
+	uint64_t bytes = 0;
+	for (int k = 0; k < tileRows; ++k) {
+		for (int l = 0; l < tileCols; ++l) {
+			const block_t &block = conf.matrix[blockIndex(k, l, tileRows, tileCols)];
+			sizes[k * tileCols + l] = coded ? encodeTile(&block[0][0], BSX, BSY, &buffer[bytes]) : sizeof(block_t);
+			bytes += sizes[k * tileCols + l];
+		}
+	}
+
+	uint64_t base = 0;
+	MPI_Exscan(&bytes, &base, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+	if (!rank) base = 0;
+
+	MPI_File file;
+	if (MPI_File_open(MPI_COMM_WORLD, conf.fieldFileName.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+		if (!rank) fieldFileError(conf.fieldFileName);
+		exit(1);
+	}
+	MPI_File_set_size(file, 0);
+
+	std::vector<FieldTile> index(rowBlocks * colBlocks, FieldTile {0, 0});
+	uint64_t position = 0;
+	for (int k = 0; k < tileRows; ++k) {
+		for (int l = 0; l < tileCols; ++l) {
+			const int global = (conf.rowSplit[rx] + k) * colBlocks + conf.colSplit[ry] + l;
+			FieldTile &tile = index[global];
+			tile.size = sizes[k * tileCols + l];
+			tile.offset = coded ? dataOffset + base + position : dataOffset + (uint64_t) global * sizeof(block_t);
+
+			const void *data = coded ? (const void *) &buffer[position] : (const void *) conf.matrix[blockIndex(k, l, tileRows, tileCols)];
+			if (MPI_File_write_at(file, tile.offset, data, tile.size, MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS) {
+				fieldFileError(conf.fieldFileName);
+			}
+			position += tile.size;
+		}
+	}
+
+	std::vector<FieldTile> all(rank ? 0 : index.size());
+	MPI_Reduce(index.data(), all.data(), 2 * index.size(), MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (!rank) {
+		FieldHeader header = fieldHeader(conf.rows, conf.cols, rowBlocks, colBlocks, BSX, BSY, sizeof(real_t), coded);
+		if (MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS
+				|| MPI_File_write_at(file, sizeof(header), all.data(), all.size() * sizeof(FieldTile), MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS) {
+			fieldFileError(conf.fieldFileName);
+		}
+	}
+	MPI_File_close(&file);
+}
+
+// Only rank 0 reads the sources file; the other ranks get the layout, the
+// sources and their keyframes in two broadcasts
+static void broadcastSources(HeatConfiguration &conf, int rank)
+{
+	if (!rank) readSourcesFile(conf);
+
+	int header[4] = {conf.processLayout.x, conf.processLayout.y, conf.numHeatSources, (int) conf.keyframes.size()};
+	MPI_Bcast(header, 4, MPI_INT, 0, MPI_COMM_WORLD);
+
+	const size_t sourcesBytes = (size_t) header[2] * sizeof(HeatSource);
+	const size_t keyframesBytes = (size_t) header[3] * sizeof(HeatKeyframe);
+	std::vector<char> buffer(sourcesBytes + keyframesBytes);
+	if (!rank) {
+		memcpy(buffer.data(), conf.heatSources, sourcesBytes);
+		memcpy(buffer.data() + sourcesBytes, conf.keyframes.data(), keyframesBytes);
+	}
+	MPI_Bcast(buffer.data(), buffer.size(), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+	if (rank) {
+		conf.processLayout = ProcessLayout(header[0], header[1]);
+		conf.numHeatSources = header[2];
+		conf.heatSources = (HeatSource *) malloc(std::max(sourcesBytes, sizeof(HeatSource)));
+		assert(conf.heatSources != nullptr);
+		memcpy(conf.heatSources, buffer.data(), sourcesBytes);
+		conf.keyframes.resize(header[3]);
+		memcpy(conf.keyframes.data(), buffer.data() + sourcesBytes, keyframesBytes);
+	}
+}
+
+// Every rank solves whole cases, round-robin, on one pooled grid in a
+// communicator of its own
+static int solveEnsemble(HeatConfiguration &conf, int rank, int rank_size)
+{
+	std::vector<std::string> cases = readEnsembleList(conf.ensembleFileName);
+
+	MPI_Comm_split(MPI_COMM_WORLD, rank, 0, &gridComm);
+
+	refineConfiguration(conf, 1, 1, true);
+	if (!rank) printConfiguration(conf);
+
+	int rowBlocks, colBlocks;
+	decomposeConfiguration(conf, ProcessLayout(0, 0), rowBlocks, colBlocks);
+
+	HeatConfiguration slot;
+	initializeSlot(slot, conf, rowBlocks, colBlocks);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	std::vector<double> times(cases.size(), 0.0);
+	double start = get_time();
+	for (int c = rank; c < (int) cases.size(); c += rank_size) {
+		times[c] = solveCase(slot, rowBlocks, colBlocks, cases[c], c);
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+	double end = get_time();
+
+	// Every case time comes from exactly one rank
+	std::vector<double> allTimes(cases.size(), 0.0);
+	MPI_Reduce(times.data(), allTimes.data(), cases.size(), MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (!rank) printEnsemble(conf, cases, allTimes, rank_size, 1, end - start);
+
+	finalizeSlot(slot);
+	MPI_Comm_free(&gridComm);
+	MPI_Finalize();
+
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	int provided;
@@ -30,32 +208,117 @@ int main(int argc, char **argv)
 	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 	MPI_Comm_size(MPI_COMM_WORLD, &rank_size);
 	
-	HeatConfiguration conf = readConfiguration(argc, argv);
+	HeatConfiguration conf;
+	readParameters(argc, argv, conf);
+
+	if (conf.solver == MULTIGRID) {
+		if (!rank) fprintf(stderr, "Error: The multigrid solver is only available in single-process builds!\n");
+		MPI_Finalize();
+		return 1;
+	}
+
+	if (conf.paddedBlocks) {
+		if (!rank) fprintf(stderr, "Error: Padded blocks are only available in single-process builds!\n");
+		MPI_Finalize();
+		return 1;
+	}
+
+	if (!conf.ensembleFileName.empty()) {
+		if (conf.rebalanceInterval > 0) {
+			if (!rank) fprintf(stderr, "Error: Load balancing is not available in ensemble mode!\n");
+			MPI_Finalize();
+			return 1;
+		}
+		if (!conf.traceFileName.empty()) {
+			if (!rank) fprintf(stderr, "Error: Tracing is not available in ensemble mode!\n");
+			MPI_Finalize();
+			return 1;
+		}
+		if (conf.measureEnergy) {
+			if (!rank) fprintf(stderr, "Error: Energy measurement is not available in ensemble mode!\n");
+			MPI_Finalize();
+			return 1;
+		}
+		if (conf.initialGuess != GUESS_NONE) {
+			if (!rank) fprintf(stderr, "Error: The initial guess is not available in ensemble mode!\n");
+			MPI_Finalize();
+			return 1;
+		}
+		return solveEnsemble(conf, rank, rank_size);
+	}
+
+	// The ranks exchange halo rows and columns, but not the corners
+	if (Stencil::diagonal && rank_size > 1) {
+		if (!rank) fprintf(stderr, "Error: The %s stencil is only available in single-process builds!\n", Stencil::name());
+		MPI_Finalize();
+		return 1;
+	}
+
+	broadcastSources(conf, rank);
 
 	assert (rank_size ==  conf.processLayout.x * conf.processLayout.y);
 	ProcessLayout rank2D {rank / conf.processLayout.y, rank % conf.processLayout.y};
 
-	refineConfiguration(conf, conf.processLayout.x * BSX, conf.processLayout.y * BSY, isSingleProcess);
+	refineConfiguration(conf, conf.processLayout.x, conf.processLayout.y, isSingleProcess);
 	if (!rank) printConfiguration(conf);
 	
-	conf.rowBlocks = conf.rows / BSX;
-	conf.colBlocks = conf.cols / BSY;
+	// Ranks get the same number of blocks up to one, and the ranks at the
+	// bottom and right edges hold the partial blocks. The tiles change when
+	// the load is rebalanced.
 	int rowBlocks = conf.rowBlocks;
 	int colBlocks = conf.colBlocks;
-	int rowBlocksPerRank = conf.rowBlocks / conf.processLayout.x;
-	int colBlocksPerRank = conf.colBlocks / conf.processLayout.y;
-	
+	int rowBlocksPerRank, colBlocksPerRank;
+	decomposeConfiguration(conf, rank2D, rowBlocksPerRank, colBlocksPerRank);
 
+	// Each rank keeps the sources that reach its boundary halos; the tiles
+	// move when the load is rebalanced, and the coarse initial guess solves
+	// the whole grid, so then every rank keeps them all
+	if (conf.rebalanceInterval == 0 && conf.initialGuess != GUESS_COARSE) {
+		keepBoundarySources(conf, rowBlocksPerRank, colBlocksPerRank, rank2D);
+	}
 
 	int err = initialize(conf, rowBlocksPerRank, colBlocksPerRank, rank2D);
 	assert(!err);
+	if (conf.initialGuess != GUESS_NONE) {
+		storeLeftHalo(conf, rowBlocksPerRank, colBlocksPerRank, rank2D);
+	}
+	setupHaloCodec(conf, rank2D);
+	if (!conf.traceFileName.empty()) startTrace();
+
+	// The counters cover a whole node, so one rank per node reads them
+	EnergyMeter meter;
+	double joules[NUM_ENERGY_DOMAINS + 1] = {0.0};
+	bool energyReader = conf.measureEnergy && isFirstOnNode(rank);
 	
 	MPI_Barrier(MPI_COMM_WORLD);
+	if (energyReader) startEnergy(meter);
 	
 	// Solve the problem
 	double start = get_time();
-	solve(conf.matrix, rowBlocksPerRank, colBlocksPerRank, conf, conf.halos_row, conf.halos_col, rank2D);
+	if (conf.rebalanceInterval > 0) {
+		solveBalanced(conf, rowBlocksPerRank, colBlocksPerRank, rank2D);
+	} else {
+		solve(conf.matrix, rowBlocksPerRank, colBlocksPerRank, conf, conf.halos_row, conf.halos_col, rank2D);
+	}
 	double end = get_time();
+	printHaloCodecStats(conf);
+
+	// Sum the energy of the nodes, and count the nodes that measured it
+	double totalJoules[NUM_ENERGY_DOMAINS + 1] = {0.0};
+	if (conf.measureEnergy) {
+		if (energyReader) {
+			stopEnergy(meter, joules);
+			joules[NUM_ENERGY_DOMAINS] = meter.zones.empty() ? 0.0 : 1.0;
+		}
+		MPI_Reduce(joules, totalJoules, NUM_ENERGY_DOMAINS + 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+		if (!rank && totalJoules[NUM_ENERGY_DOMAINS] == 0.0) {
+			fprintf(stderr, "Warning: No RAPL energy counters can be read, the energy is not reported!\n");
+		}
+	}
+	if (!conf.traceFileName.empty()) {
+		stopTrace();
+		gatherTrace(conf, start, rank, rank_size);
+	}
 	
 	if (!rank) {
 		long totalElements = (long)conf.rows * (long)conf.cols;
@@ -65,20 +328,30 @@ int main(int argc, char **argv)
 		
 #ifdef _OMPSS_2
 		int threads = nanos_get_num_cpus();
+#elif defined(_OPENMP)
+		int threads = omp_get_max_threads();
 #else
 		int threads = 1;
 #endif
 		
 		fprintf(stdout, "rows, %d, cols, %d, rows_per_rank, %d, total, %ld, total_per_rank, %ld, bs, %d"
-				" ,ranks, %d, threads, %d, timesteps, %d, time, %f, performance, %f\n",
+				" ,ranks, %d, threads, %d, timesteps, %d, time, %f, performance, %f",
 				conf.rows, conf.cols, conf.rows / rank_size, totalElements, totalElements / rank_size,
 				BSX, rank_size, threads, conf.timesteps, end - start, performance);
+		if (totalJoules[NUM_ENERGY_DOMAINS] > 0.0) {
+			printEnergy(totalJoules, end - start, (double) totalElements * conf.timesteps);
+		}
+		fprintf(stdout, "\n");
 	}
 	
 	if (conf.generateImage) {
 		generateImage(conf, rowBlocks, colBlocks, rowBlocksPerRank, colBlocksPerRank);
 	}
 
+	if (conf.generateField) {
+		writeFieldFile(conf, rowBlocks, colBlocks, rank);
+	}
+
 	
 	err = finalize(conf);
 	assert(!err);
@@ -97,6 +370,20 @@ void generateImage(const HeatConfiguration &conf, int rowBlocks, int colBlocks,
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &rank_size);
 
+    // Tiles of every rank, as left by the last rebalance
+    std::vector<int> counts(rank_size), displs(rank_size);
+    std::vector<int> tileRows(rank_size), tileCols(rank_size), tileRowOffset(rank_size), tileColOffset(rank_size);
+    for (int i = 0, r = 0; i < conf.processLayout.x; i ++) {
+        for (int j = 0; j < conf.processLayout.y; j ++, r ++) {
+            tileRowOffset[r] = conf.rowSplit[i];
+            tileColOffset[r] = conf.colSplit[j];
+            tileRows[r] = conf.rowSplit[i+1] - conf.rowSplit[i];
+            tileCols[r] = conf.colSplit[j+1] - conf.colSplit[j];
+            counts[r] = tileRows[r] * tileCols[r] * BSX * BSY;
+            displs[r] = (r == 0) ? 0 : displs[r-1] + counts[r-1];
+        }
+    }
+
     if (!rank) {
             auxMatrix = (block_t *) malloc(rowBlocks * colBlocks * sizeof(block_t));
             if (auxMatrix == NULL) {
@@ -108,9 +395,9 @@ void generateImage(const HeatConfiguration &conf, int rowBlocks, int colBlocks,
     }
 
     int count = rowBlocksPerRank  * colBlocksPerRank * BSX * BSY;
-    MPI_Gather(
-            conf.matrix, count, MPI_DOUBLE,
-            auxMatrix, count, MPI_DOUBLE,
+    MPI_Gatherv(
+            conf.matrix, count, HEAT_MPI_REAL,
+            auxMatrix, counts.data(), displs.data(), HEAT_MPI_REAL,
             0, MPI_COMM_WORLD
     );
 
@@ -123,25 +410,20 @@ void generateImage(const HeatConfiguration &conf, int rowBlocks, int colBlocks,
 			exit(1);
 		}
 
-		int counter = 0;
-		for(int i = 0; i < conf.processLayout.x; i ++) {
-			for (int j = 0; j < conf.processLayout.y; j ++)	{
-				for (int k = 0; k < rowBlocksPerRank; ++k )	{
-					for (int l = 0; l < colBlocksPerRank; ++l){
-						memcpy (pivotedMatrix[ i * (colBlocks * rowBlocksPerRank) + j * colBlocksPerRank + k * colBlocks + l],
-								auxMatrix[counter++],
-								sizeof(block_t));
-
-
-
-					}
+		for (int r = 0; r < rank_size; r ++) {
+			block_t *tile = &auxMatrix[displs[r] / (BSX * BSY)];
+			for (int k = 0; k < tileRows[r]; ++k ) {
+				for (int l = 0; l < tileCols[r]; ++l) {
+					memcpy (pivotedMatrix[blockIndex(tileRowOffset[r] + k, tileColOffset[r] + l, rowBlocks, colBlocks)],
+							tile[blockIndex(k, l, tileRows[r], tileCols[r])],
+							sizeof(block_t));
 				}
 			}
 		}
     }
 
     if (!rank) {
-            int err = writeImage(conf.imageFileName, pivotedMatrix, rowBlocks, colBlocks);
+            int err = writeImage(conf.imageFileName, pivotedMatrix, rowBlocks, colBlocks, conf.rows, conf.cols);
             assert(!err);
 
             free(auxMatrix);
@@ -149,4 +431,3 @@ void generateImage(const HeatConfiguration &conf, int rowBlocks, int colBlocks,
     }
 
 }
-
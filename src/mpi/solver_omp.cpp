@@ -1,108 +1,42 @@
 #include <mpi.h>
 #include <algorithm>
+#include <cassert>
 
 #include "common/heat.hpp"
-
-inline void solveBlock(block_t *matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, ProcessLayout rank2D, HeatConfiguration &conf)
-{
-	block_t &targetBlock = matrix[bx*nby + by];
-	const block_t &centerBlock = matrix[bx*nby + by];
-	const block_t &topBlock    = matrix[(bx-1)*nby + by];
-	const block_t &leftBlock   = matrix[bx*nby + (by-1)];
-	const block_t &rightBlock  = matrix[bx*nby + (by+1)];
-	const block_t &bottomBlock = matrix[(bx+1)*nby + by];
-
-	const row_t &halo_top    = (bx == 0)    ? halo_row[top]   [by] : topBlock[BSX-1];
-	const row_t &halo_bottom = (bx == nbx-1)? halo_row[bottom][by] : bottomBlock[0];
-
-	double sum = 0.0;
-	for (int x = 0; x < BSX; ++x) {
-
-		const row_t &topRow    = (x > 0)     ? centerBlock[x-1] : halo_top;
-		const row_t &bottomRow = (x < BSX-1) ? centerBlock[x+1] : halo_bottom;
-
-		const double halo_left_element  = (by == 0)     ? halo_col[left] [bx][x] : leftBlock [x][BSY-1];
-		const double halo_right_element = (by == nby-1) ? halo_col[right][bx][x] : rightBlock[x][0];
-
-		for (int y = 0; y < BSY; ++y) {
-
-			double leftElement  = (y > 0)     ? centerBlock[x][y-1] : halo_left_element;
-			double rightElement = (y < BSY-1) ? centerBlock[x][y+1] : halo_right_element;
-
-			double value = 0.25 * (topRow[y] + bottomRow[y] + leftElement + rightElement);
-			double diff = value - targetBlock[x][y];
-
-			halo_col[left] [bx][x]  = (rank2D.y != 0                      && by == 0     && y == 0)     ? value : halo_col[left] [bx][x] ;
-			halo_col[right][bx][x]  = (rank2D.y != conf.processLayout.x-1 && by == nby-1 && y == BSY-1) ? value : halo_col[right][bx][x] ;
-
-			targetBlock[x][y] = value;
-		}
-	}
-}
-
-//A
-inline void sendFirstComputeRow(block_t *matrix, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
-{
-	for (int by = 0; by < nby; ++by) {
-
-		MPI_Send(&matrix[by][0][0], BSY, MPI_DOUBLE, rank2D.getNorth(conf.processLayout), by, MPI_COMM_WORLD);
-	}
-}
-
-//A
-inline void receiveLowerBorder(row_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
-{
-	for (int by = 0; by < nby; ++by) {
-		MPI_Recv(&halo[by], BSY, MPI_DOUBLE, rank2D.getSouth(conf.processLayout), by, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-	}
-}
-
-//B
-inline void sendLastComputeRow(block_t *matrix, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
-{
-	for (int by = 0; by < nby; ++by) {
-		MPI_Send(&matrix[(nbx-1)*nby + by][BSX-1][0], BSY, MPI_DOUBLE, rank2D.getSouth(conf.processLayout), by, MPI_COMM_WORLD);
-	}
-}
-
-//B
-inline void receiveUpperBorder(row_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
+#include "common/activity.hpp"
+#include "common/jacobi.hpp"
+#include "common/stencil.hpp"
+#include "mpi/borders.hpp"
+#include "mpi/exchange.hpp"
+
+// Update one block unless active-region tracking shows that it cannot change
+// (blocks next to another rank are always updated, as their halos are
+// replaced every step)
+inline void updateBlock(block_t *matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, ProcessLayout rank2D, HeatConfiguration &conf, int step)
 {
-	for (int by = 0; by < nby; ++by) {
-		MPI_Recv(&halo[by], BSY, MPI_DOUBLE, rank2D.getNorth(conf.processLayout), by, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	double *change = conf.blockChange;
+	if (change != nullptr && !hasRemoteHalo(nbx, nby, bx, by, rank2D, conf)
+			&& !isBlockActive(change, nbx, nby, bx, by, conf.activeTolerance)) {
+		change[blockIndex(bx, by, nbx, nby)] = 0.0;
+		return;
 	}
-}
 
-//C
-inline void sendLeftBorder(col_t *halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
-{
-	for (int bx = 0; bx < nbx; ++bx) {
-		MPI_Send(&halo[bx], BSX, MPI_DOUBLE, rank2D.getEast(conf.processLayout), bx+nby, MPI_COMM_WORLD);
-	}
-}
+	const int nx = (bx == nbx-1) ? conf.lastBlockRows : BSX;
+	const int ny = (by == nby-1) ? conf.lastBlockCols : BSY;
+	const double start = (conf.blockTime != nullptr) ? get_time() : 0.0;
+	const double traced = traceBegin();
+	const HaloDepths depths = haloDepths(rank2D, conf);
 
-//C
-inline void receiveRightBorder(col_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
-{
-	for (int bx = 0; bx < nbx; ++bx) {
-		MPI_Recv(&halo[bx], BSX, MPI_DOUBLE, rank2D.getWest(conf.processLayout), bx+nby, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-	}
-}
+	double sum = solveStencil(matrix, halo_row, halo_col, depths, nbx, nby, bx, by, nx, ny, conf.omega);
+	storeBorderColumns(matrix, halo_col, nbx, nby, bx, by, nx, ny, rank2D, conf);
 
-//D
-inline void sendRightBorder(col_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
-{
-	for (int bx = 0; bx < nbx; ++bx) {
-		MPI_Send(&halo[bx], BSX, MPI_DOUBLE, rank2D.getWest(conf.processLayout), bx+nby, MPI_COMM_WORLD);
+	if (change != nullptr) {
+		change[blockIndex(bx, by, nbx, nby)] = sum;
 	}
-}
-
-//D
-inline void receiveLeftBorder(col_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
-{
-	for (int bx = 0; bx < nbx; ++bx) {
-		MPI_Recv(&halo[bx], BSX, MPI_DOUBLE, rank2D.getEast(conf.processLayout), bx+nby, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	if (conf.blockTime != nullptr) {
+		conf.blockTime[blockIndex(bx, by, nbx, nby)] += get_time() - start;
 	}
+	traceEnd(TRACE_BLOCK, bx, by, step, traced);
 }
 
 inline void solveGaussSeidel(block_t *matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
@@ -128,23 +62,50 @@ inline void solveGaussSeidel(block_t *matrix, row_t ** halo_row, col_t ** halo_c
 
 	int bsX = BSX;
 	int bsY = BSY;
-
-	for (int bx = 0; bx < nbx; ++bx) {
-		for (int by = 0; by < nby; ++by) {
-
-			block_t * topBlock    = (bx == 0)     ? nullptr : & matrix[(bx-1)*nby + by];
-			block_t * bottomBlock = (bx == nbx-1) ? nullptr : & matrix[(bx+1)*nby + by];
-			block_t * leftBlock   = (by == 0)     ? nullptr : & matrix[bx*nby + (by-1)];
-			block_t * rightBlock  = (by == nby-1) ? nullptr : & matrix[bx*nby + (by+1)];
-
-			#pragma oss task label(gauss seidel) \
-				in ([1]topBlock)              \
-				in ([1]leftBlock)             \
-				in ([1]rightBlock)            \
-				in ([1]bottomBlock)           \
-				inout(([nbx][nby]matrix)[bx][by])
-			solveBlock(matrix, halo_row, halo_col, nbx, nby, bx, by, rank2D, conf);
-		}
+	const int step = conf.step;
+
+	// A diagonal stencil also reads the diagonal blocks and, along the tile
+	// edges, the halo segments of the neighbouring blocks; the border blocks
+	// along an edge already follow each other, so their halo ranges stay inout
+	const int reach = Stencil::diagonal ? 1 : 0;
+
+	for (int i = 0; i < nbx*nby; ++i) {
+		int bx, by;
+		sweepBlock(i, nbx, nby, bx, by);
+		block_t * topBlock    = (bx == 0)     ? nullptr : & matrix[blockIndex(bx-1, by, nbx, nby)];
+		block_t * bottomBlock = (bx == nbx-1) ? nullptr : & matrix[blockIndex(bx+1, by, nbx, nby)];
+		block_t * leftBlock   = (by == 0)     ? nullptr : & matrix[blockIndex(bx, by-1, nbx, nby)];
+		block_t * rightBlock  = (by == nby-1) ? nullptr : & matrix[blockIndex(bx, by+1, nbx, nby)];
+		block_t * topLeftBlock     = (!reach || bx == 0     || by == 0)     ? nullptr : & matrix[blockIndex(bx-1, by-1, nbx, nby)];
+		block_t * topRightBlock    = (!reach || bx == 0     || by == nby-1) ? nullptr : & matrix[blockIndex(bx-1, by+1, nbx, nby)];
+		block_t * bottomLeftBlock  = (!reach || bx == nbx-1 || by == 0)     ? nullptr : & matrix[blockIndex(bx+1, by-1, nbx, nby)];
+		block_t * bottomRightBlock = (!reach || bx == nbx-1 || by == nby-1) ? nullptr : & matrix[blockIndex(bx+1, by+1, nbx, nby)];
+
+		// Halo segments along the row and the column of the block
+		const int firstCol = std::max(by - reach, 0);
+		const int firstRow = std::max(bx - reach, 0);
+		const int numCols  = std::min(by + reach, nby-1) - firstCol + 1;
+		const int numRows  = std::min(bx + reach, nbx-1) - firstRow + 1;
+		const int topCols     = (bx != 0)     ? 0 : numCols;
+		const int bottomCols  = (bx != nbx-1) ? 0 : numCols;
+		const int leftRows    = (by != 0)     ? 0 : numRows;
+		const int rightRows   = (by != nby-1) ? 0 : numRows;
+
+		#pragma oss task label(gauss seidel) \
+			in ([1]topBlock)              \
+			in ([1]leftBlock)             \
+			in ([1]rightBlock)            \
+			in ([1]bottomBlock)           \
+			in ([1]topLeftBlock)          \
+			in ([1]topRightBlock)         \
+			in ([1]bottomLeftBlock)       \
+			in ([1]bottomRightBlock)      \
+			in ({halo_row[top][j], j=firstCol;topCols})          \
+			in ({halo_row[bottom][j], j=firstCol;bottomCols})    \
+			inout ({halo_col[left][r], r=firstRow;leftRows})     \
+			inout ({halo_col[right][r], r=firstRow;rightRows})   \
+			inout(matrix[blockIndex(bx, by, nbx, nby)])
+		updateBlock(matrix, halo_row, halo_col, nbx, nby, bx, by, rank2D, conf, step);
 	}
 
 	#pragma oss taskwait
@@ -158,13 +119,75 @@ inline void solveGaussSeidel(block_t *matrix, row_t ** halo_row, col_t ** halo_c
 	}
 }
 
+inline void solveJacobi(block_t *source, block_t *target, row_t ** halo_row, col_t ** halo_col, col_t ** sendCols, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
+{
+	std::vector<MPI_Request> recvs, sends;
+	postHaloExchange(source, halo_row, halo_col, sendCols, nbx, nby, rank2D, conf, recvs, sends);
+	const int step = conf.step;
+
+	// Inner blocks do not read the halos and run while the exchange completes
+	for (int i = 0; i < nbx*nby; ++i) {
+		int bx, by;
+		storedBlock(i, nbx, nby, bx, by);
+		if (!isBorderBlock(nbx, nby, bx, by)) {
+			#pragma oss task label(jacobi)
+			jacobiBlock(source, target, halo_row, halo_col, nbx, nby, bx, by, conf, step);
+		}
+	}
+
+	waitHaloReceives(recvs, step);
+
+	for (int i = 0; i < nbx*nby; ++i) {
+		int bx, by;
+		storedBlock(i, nbx, nby, bx, by);
+		if (isBorderBlock(nbx, nby, bx, by)) {
+			row_t * haloTop       = (bx != 0)     ? nullptr : & halo_row[top][by];
+			row_t * haloBottom    = (bx != nbx-1) ? nullptr : & halo_row[bottom][by];
+			col_t * haloLeft      = (by != 0)     ? nullptr : & halo_col[left][bx];
+			col_t * haloRight     = (by != nby-1) ? nullptr : & halo_col[right][bx];
+
+			#pragma oss task label(jacobi border) \
+				in ([1]haloTop)                 \
+				in ([1]haloBottom)              \
+				in ([1]haloLeft)                \
+				in ([1]haloRight)
+			jacobiBlock(source, target, halo_row, halo_col, nbx, nby, bx, by, conf, step);
+		}
+	}
+
+	#pragma oss taskwait
+	waitAll(sends);
+}
+
 double solve(block_t *matrix, int rowBlocks, int colBlocks, HeatConfiguration &conf,  row_t ** halo_row, col_t ** halo_col, ProcessLayout rank2D )
 {
-	for (int t = 0; t < conf.timesteps; ++t) {
-		solveGaussSeidel(matrix, halo_row, halo_col, rowBlocks, colBlocks, rank2D, conf);
+	if (conf.solver == JACOBI) {
+		block_t *source = matrix;
+		block_t *target = conf.nextMatrix;
+		col_t *sendCols[2];
+		sendCols[left]  = (col_t *) calloc(rowBlocks, sizeof(col_t));
+		sendCols[right] = (col_t *) calloc(rowBlocks, sizeof(col_t));
+		assert(sendCols[left] != nullptr && sendCols[right] != nullptr);
+
+		for (int t = 0; t < conf.timesteps; ++t, ++conf.step) {
+			updateHalos(conf, rowBlocks, colBlocks, rank2D);
+			solveJacobi(source, target, halo_row, halo_col, sendCols, rowBlocks, colBlocks, rank2D, conf);
+			std::swap(source, target);
+		}
+
+		// Leave the latest solution in conf.matrix
+		conf.matrix = source;
+		conf.nextMatrix = target;
+		free(sendCols[left]);
+		free(sendCols[right]);
+	} else {
+		for (int t = 0; t < conf.timesteps; ++t, ++conf.step) {
+			updateHalos(conf, rowBlocks, colBlocks, rank2D);
+			solveGaussSeidel(matrix, halo_row, halo_col, rowBlocks, colBlocks, rank2D, conf);
+		}
 	}
 
-	MPI_Barrier(MPI_COMM_WORLD);
+	MPI_Barrier(gridComm);
 
 	return 0.0;
 }
@@ -1,57 +1,111 @@
 #include <mpi.h>
 #include <algorithm>
+#include <cassert>
 #include "common/heat.hpp"
-
-#ifdef INTEROPERABILITY
-int *serial = nullptr;
-#else
-int *serial = (int *) 1;
-#endif
+#include "common/activity.hpp"
+#include "common/jacobi.hpp"
+#include "common/stencil.hpp"
+#include "mpi/exchange.hpp"
+#include "mpi/taskaware.hpp"
 
 
-inline void solveBlock(block_t *matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, ProcessLayout rank2D, HeatConfiguration &conf)
+// Update one block unless active-region tracking shows that it cannot change
+// (blocks next to another rank are always updated, as their halos are
+// replaced every step)
+inline void updateBlock(block_t *matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, ProcessLayout rank2D, HeatConfiguration &conf, int step)
 {
-	block_t &targetBlock = matrix[bx*nby + by];
-	const block_t &centerBlock = matrix[bx*nby + by];
-	const block_t &topBlock    = matrix[(bx-1)*nby + by];
-	const block_t &leftBlock   = matrix[bx*nby + (by-1)];
-	const block_t &rightBlock  = matrix[bx*nby + (by+1)];
-	const block_t &bottomBlock = matrix[(bx+1)*nby + by];
-
-	const row_t &halo_top    = (bx == 0)    ? halo_row[top]   [by] : topBlock[BSX-1];
-	const row_t &halo_bottom = (bx == nbx-1)? halo_row[bottom][by] : bottomBlock[0];
-
-	double sum = 0.0;
-	for (int x = 0; x < BSX; ++x) {
-
-		const row_t &topRow    = (x > 0)     ? centerBlock[x-1] : halo_top;
-		const row_t &bottomRow = (x < BSX-1) ? centerBlock[x+1] : halo_bottom;
-
-		const double halo_left_element  = (by == 0)     ? halo_col[left] [bx][x] : leftBlock [x][BSY-1];
-		const double halo_right_element = (by == nby-1) ? halo_col[right][bx][x] : rightBlock[x][0];
-
-		for (int y = 0; y < BSY; ++y) {
+	double *change = conf.blockChange;
+	if (change != nullptr && !hasRemoteHalo(nbx, nby, bx, by, rank2D, conf)
+			&& !isBlockActive(change, nbx, nby, bx, by, conf.activeTolerance)) {
+		change[blockIndex(bx, by, nbx, nby)] = 0.0;
+		return;
+	}
 
-			double leftElement  = (y > 0)     ? centerBlock[x][y-1] : halo_left_element;
-			double rightElement = (y < BSY-1) ? centerBlock[x][y+1] : halo_right_element;
+	const int nx = (bx == nbx-1) ? conf.lastBlockRows : BSX;
+	const int ny = (by == nby-1) ? conf.lastBlockCols : BSY;
+	const double start = (conf.blockTime != nullptr) ? get_time() : 0.0;
+	const double traced = traceBegin();
+	const HaloDepths depths = haloDepths(rank2D, conf);
 
-			double value = 0.25 * (topRow[y] + bottomRow[y] + leftElement + rightElement);
-			double diff = value - targetBlock[x][y];
+	double sum = solveStencil(matrix, halo_row, halo_col, depths, nbx, nby, bx, by, nx, ny, conf.omega);
+	storeBorderColumns(matrix, halo_col, nbx, nby, bx, by, nx, ny, rank2D, conf);
 
-			halo_col[left] [bx][x]  = (rank2D.y != 0                      && by == 0     && y == 0)     ? value : halo_col[left] [bx][x] ;
-			halo_col[right][bx][x]  = (rank2D.y != conf.processLayout.x-1 && by == nby-1 && y == BSY-1) ? value : halo_col[right][bx][x] ;
+	if (change != nullptr) {
+		change[blockIndex(bx, by, nbx, nby)] = sum;
+	}
+	if (conf.blockTime != nullptr) {
+		conf.blockTime[blockIndex(bx, by, nbx, nby)] += get_time() - start;
+	}
+	traceEnd(TRACE_BLOCK, bx, by, step, traced);
+}
 
-			targetBlock[x][y] = value;
+// Receive one halo row or column from source. A compressed halo arrives in
+// the codec buffer of its slot and is decoded by a second task. The tasks
+// depend on the whole halo, as the block tasks that read it do.
+template <typename Halo>
+inline void receiveHalo(Halo *halo, int source, int tag, HaloEdge edge, int slot, int step)
+{
+	const int count = sizeof(Halo) / sizeof(real_t);
+	if (!haloCompressed(edge)) {
+		TaskEvent event = TaskEvent();
+#ifdef HEAT_TASK_DETACH
+		#pragma omp task detach(event) depend(out: halo[0])
+#else
+		#pragma oss task label(receive halo) out(*halo)
+#endif
+		{
+			const double traced = traceBegin();
+			MPI_Request request;
+			MPI_Irecv(*halo, count, HEAT_MPI_REAL, source, tag, gridComm, &request);
+			bindRequest(request, event);
+			traceEnd(TRACE_RECV, edge, slot, step, traced);
 		}
+		return;
+	}
+
+	unsigned char *buffer = haloReceiveBuffer(edge, slot, count);
+	TaskEvent event = TaskEvent();
+#ifdef HEAT_TASK_DETACH
+	#pragma omp task detach(event) depend(out: buffer[0])
+#else
+	#pragma oss task label(receive compressed halo) out(*buffer)
+#endif
+	{
+		const double traced = traceBegin();
+		MPI_Request request;
+		MPI_Irecv(buffer, haloMessageSize(count), MPI_BYTE, source, tag, gridComm, &request);
+		bindRequest(request, event);
+		traceEnd(TRACE_RECV, edge, slot, step, traced);
 	}
+
+#ifdef HEAT_TASK_DETACH
+	#pragma omp task depend(in: buffer[0]) depend(out: halo[0])
+#else
+	#pragma oss task label(decode halo) in(*buffer) out(*halo)
+#endif
+	decodeHalo(edge, slot, *halo, count);
 }
 
 //A
 inline void sendFirstComputeRow(block_t *matrix, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
 {
+	const int step = conf.step;
 	for (int by = 0; by < nby; ++by) {
-		#pragma oss task label(send first row) in(([nbx][nby]matrix)[0][by]) inout(*serial)
-		MPI_Send(&matrix[by][0][0], BSY, MPI_DOUBLE, rank2D.getNorth(conf.processLayout), by, MPI_COMM_WORLD);
+		for (int d = 0; d < HaloDepth; ++d) {
+			TaskEvent event = TaskEvent();
+#ifdef HEAT_TASK_DETACH
+			#pragma omp task detach(event) depend(in: matrix[blockIndex(0, by, nbx, nby)]) shared(conf)
+#else
+			#pragma oss task label(send first row) in(matrix[blockIndex(0, by, nbx, nby)])
+#endif
+			{
+				const double traced = traceBegin();
+				MPI_Request request;
+				isendHalo(matrix[blockIndex(0, by, nbx, nby)][d], BSY, rank2D.getNorth(conf.processLayout), haloDepthIndex(by, d), TOP_EDGE, haloDepthIndex(by, d), request);
+				bindRequest(request, event);
+				traceEnd(TRACE_SEND, TOP_EDGE, haloDepthIndex(by, d), step, traced);
+			}
+		}
 	}
 }
 
@@ -59,17 +113,32 @@ inline void sendFirstComputeRow(block_t *matrix, int nbx, int nby, ProcessLayout
 inline void receiveLowerBorder(row_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
 {
 	for (int by = 0; by < nby; ++by) {
-		#pragma oss task label(receive lower border) out(([nby] halo)[by]) inout(*serial)
-		MPI_Recv(&halo[by], BSY, MPI_DOUBLE, rank2D.getSouth(conf.processLayout), by, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		for (int d = 0; d < HaloDepth; ++d) {
+			receiveHalo(&halo[d * nby + by], rank2D.getSouth(conf.processLayout), haloDepthIndex(by, d), BOTTOM_EDGE, haloDepthIndex(by, d), conf.step);
+		}
 	}
 }
 
 //B
 inline void sendLastComputeRow(block_t *matrix, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
 {
+	const int step = conf.step;
 	for (int by = 0; by < nby; ++by) {
-		#pragma oss task label(send last row) in(([nbx][nby]matrix)[nbx-1][by]) inout(*serial)
-		MPI_Send(&matrix[(nbx-1)*nby + by][BSX-1][0], BSY, MPI_DOUBLE, rank2D.getSouth(conf.processLayout), by, MPI_COMM_WORLD);
+		for (int d = 0; d < HaloDepth; ++d) {
+			TaskEvent event = TaskEvent();
+#ifdef HEAT_TASK_DETACH
+			#pragma omp task detach(event) depend(in: matrix[blockIndex(nbx-1, by, nbx, nby)]) shared(conf)
+#else
+			#pragma oss task label(send last row) in(matrix[blockIndex(nbx-1, by, nbx, nby)])
+#endif
+			{
+				const double traced = traceBegin();
+				MPI_Request request;
+				isendHalo(matrix[blockIndex(nbx-1, by, nbx, nby)][BSX-1-d], BSY, rank2D.getSouth(conf.processLayout), haloDepthIndex(by, d), BOTTOM_EDGE, haloDepthIndex(by, d), request);
+				bindRequest(request, event);
+				traceEnd(TRACE_SEND, BOTTOM_EDGE, haloDepthIndex(by, d), step, traced);
+			}
+		}
 	}
 }
 
@@ -77,17 +146,32 @@ inline void sendLastComputeRow(block_t *matrix, int nbx, int nby, ProcessLayout
 inline void receiveUpperBorder(row_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
 {
 	for (int by = 0; by < nby; ++by) {
-		#pragma oss task label(receive upper border) out(([nby] halo)[by]) inout(*serial)
-		MPI_Recv(&halo[by], BSY, MPI_DOUBLE, rank2D.getNorth(conf.processLayout), by, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		for (int d = 0; d < HaloDepth; ++d) {
+			receiveHalo(&halo[d * nby + by], rank2D.getNorth(conf.processLayout), haloDepthIndex(by, d), TOP_EDGE, haloDepthIndex(by, d), conf.step);
+		}
 	}
 }
 
 //C
 inline void sendLeftBorder(col_t *halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
 {
+	const int step = conf.step;
 	for (int bx = 0; bx < nbx; ++bx) {
-		#pragma oss task label(send left column) in(([nbx] halo)[bx]) inout(*serial)
-		MPI_Send(&halo[bx], BSX, MPI_DOUBLE, rank2D.getEast(conf.processLayout), bx+nby, MPI_COMM_WORLD);
+		for (int d = 0; d < HaloDepth; ++d) {
+			TaskEvent event = TaskEvent();
+#ifdef HEAT_TASK_DETACH
+			#pragma omp task detach(event) depend(in: halo[d * nbx + bx]) shared(conf)
+#else
+			#pragma oss task label(send left column) in(([HaloDepth * nbx] halo)[d * nbx + bx])
+#endif
+			{
+				const double traced = traceBegin();
+				MPI_Request request;
+				isendHalo(halo[d * nbx + bx], BSX, rank2D.getEast(conf.processLayout), haloDepthIndex(bx+conf.colBlocks, d), LEFT_EDGE, haloDepthIndex(bx, d), request);
+				bindRequest(request, event);
+				traceEnd(TRACE_SEND, LEFT_EDGE, haloDepthIndex(bx, d), step, traced);
+			}
+		}
 	}
 }
 
@@ -95,17 +179,32 @@ inline void sendLeftBorder(col_t *halo, int nbx, int nby, ProcessLayout rank2D,
 inline void receiveRightBorder(col_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
 {
 	for (int bx = 0; bx < nbx; ++bx) {
-		#pragma oss task label(receive right border) out(([nbx] halo)[bx]) inout(*serial)
-		MPI_Recv(&halo[bx], BSX, MPI_DOUBLE, rank2D.getWest(conf.processLayout), bx+nby, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		for (int d = 0; d < HaloDepth; ++d) {
+			receiveHalo(&halo[d * nbx + bx], rank2D.getWest(conf.processLayout), haloDepthIndex(bx+conf.colBlocks, d), RIGHT_EDGE, haloDepthIndex(bx, d), conf.step);
+		}
 	}
 }
 
 //D
 inline void sendRightBorder(col_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
 {
+	const int step = conf.step;
 	for (int bx = 0; bx < nbx; ++bx) {
-		#pragma oss task label(send right column) in(([nbx] halo)[bx]) inout(*serial)
-		MPI_Send(&halo[bx], BSX, MPI_DOUBLE, rank2D.getWest(conf.processLayout), bx+nby, MPI_COMM_WORLD);
+		for (int d = 0; d < HaloDepth; ++d) {
+			TaskEvent event = TaskEvent();
+#ifdef HEAT_TASK_DETACH
+			#pragma omp task detach(event) depend(in: halo[d * nbx + bx]) shared(conf)
+#else
+			#pragma oss task label(send right column) in(([HaloDepth * nbx] halo)[d * nbx + bx])
+#endif
+			{
+				const double traced = traceBegin();
+				MPI_Request request;
+				isendHalo(halo[d * nbx + bx], BSX, rank2D.getWest(conf.processLayout), haloDepthIndex(bx+conf.colBlocks, d), RIGHT_EDGE, haloDepthIndex(bx, d), request);
+				bindRequest(request, event);
+				traceEnd(TRACE_SEND, RIGHT_EDGE, haloDepthIndex(bx, d), step, traced);
+			}
+		}
 	}
 }
 
@@ -113,8 +212,122 @@ inline void sendRightBorder(col_t * halo, int nbx, int nby, ProcessLayout rank2D
 inline void receiveLeftBorder(col_t * halo, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
 {
 	for (int bx = 0; bx < nbx; ++bx) {
-		#pragma oss task label(receive left border) out(([nbx] halo)[bx]) inout(*serial)
-		MPI_Recv(&halo[bx], BSX, MPI_DOUBLE, rank2D.getEast(conf.processLayout), bx+nby, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		for (int d = 0; d < HaloDepth; ++d) {
+			receiveHalo(&halo[d * nbx + bx], rank2D.getEast(conf.processLayout), haloDepthIndex(bx+conf.colBlocks, d), LEFT_EDGE, haloDepthIndex(bx, d), conf.step);
+		}
+	}
+}
+
+// Task updating block (bx, by) after its neighbours and halos, all
+// HaloDepth rows or columns of them. The left and right halos are written by
+// the border blocks before they are sent. A diagonal stencil also reads the
+// diagonal blocks and, along the tile edges, the halo segments of the
+// neighbouring blocks; the border blocks along an edge already follow each
+// other, so their halo ranges stay inout.
+inline void gaussSeidelTask(block_t *matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, ProcessLayout rank2D, HeatConfiguration &conf, int step)
+{
+	const int reach = Stencil::diagonal ? 1 : 0;
+	const int hasTop      = (bx != 0);
+	const int hasBottom   = (bx != nbx-1);
+	const int hasLeft     = (by != 0);
+	const int hasRight    = (by != nby-1);
+	const int hasTopLeft     = reach * hasTop * hasLeft;
+	const int hasTopRight    = reach * hasTop * hasRight;
+	const int hasBottomLeft  = reach * hasBottom * hasLeft;
+	const int hasBottomRight = reach * hasBottom * hasRight;
+	const int topDepth    = HaloDepth * (1-hasTop);
+	const int bottomDepth = HaloDepth * (1-hasBottom);
+	const int leftDepth   = HaloDepth * (1-hasLeft);
+	const int rightDepth  = HaloDepth * (1-hasRight);
+
+	// Halo segments along the row and the column of the block
+	const int firstCol = by - reach * hasLeft;
+	const int firstRow = bx - reach * hasTop;
+	const int numCols  = 1 + reach * (hasLeft + hasRight);
+	const int numRows  = 1 + reach * (hasTop + hasBottom);
+
+#ifdef HEAT_TASK_DETACH
+	#pragma omp task shared(conf)                                                                         \
+	depend(iterator(k=0:hasTop), in: matrix[blockIndex(bx-1, by, nbx, nby)])                             \
+	depend(iterator(k=0:hasLeft), in: matrix[blockIndex(bx, by-1, nbx, nby)])                            \
+	depend(iterator(k=0:hasRight), in: matrix[blockIndex(bx, by+1, nbx, nby)])                           \
+	depend(iterator(k=0:hasBottom), in: matrix[blockIndex(bx+1, by, nbx, nby)])                          \
+	depend(iterator(k=0:hasTopLeft), in: matrix[blockIndex(bx-1, by-1, nbx, nby)])                       \
+	depend(iterator(k=0:hasTopRight), in: matrix[blockIndex(bx-1, by+1, nbx, nby)])                      \
+	depend(iterator(k=0:hasBottomLeft), in: matrix[blockIndex(bx+1, by-1, nbx, nby)])                    \
+	depend(iterator(k=0:hasBottomRight), in: matrix[blockIndex(bx+1, by+1, nbx, nby)])                   \
+	depend(iterator(d=0:topDepth, j=firstCol:firstCol+numCols), in: halo_row[top][d * nby + j])          \
+	depend(iterator(d=0:bottomDepth, j=firstCol:firstCol+numCols), in: halo_row[bottom][d * nby + j])    \
+	depend(iterator(d=0:leftDepth, i=firstRow:firstRow+numRows), inout: halo_col[left][d * nbx + i])     \
+	depend(iterator(d=0:rightDepth, i=firstRow:firstRow+numRows), inout: halo_col[right][d * nbx + i])   \
+	depend(inout: matrix[blockIndex(bx, by, nbx, nby)])
+#else
+	#pragma oss task label(gauss seidel)\
+	in ({matrix[blockIndex(bx-1, by, nbx, nby)], k=0;hasTop})                  \
+	in ({matrix[blockIndex(bx, by-1, nbx, nby)], k=0;hasLeft})                 \
+	in ({matrix[blockIndex(bx, by+1, nbx, nby)], k=0;hasRight})                \
+	in ({matrix[blockIndex(bx+1, by, nbx, nby)], k=0;hasBottom})               \
+	in ({matrix[blockIndex(bx-1, by-1, nbx, nby)], k=0;hasTopLeft})            \
+	in ({matrix[blockIndex(bx-1, by+1, nbx, nby)], k=0;hasTopRight})           \
+	in ({matrix[blockIndex(bx+1, by-1, nbx, nby)], k=0;hasBottomLeft})         \
+	in ({matrix[blockIndex(bx+1, by+1, nbx, nby)], k=0;hasBottomRight})        \
+	in ({halo_row[top][d * nby + j], d=0;topDepth, j=firstCol;numCols})          \
+	in ({halo_row[bottom][d * nby + j], d=0;bottomDepth, j=firstCol;numCols})    \
+	inout ({halo_col[left][d * nbx + i], d=0;leftDepth, i=firstRow;numRows})     \
+	inout ({halo_col[right][d * nbx + i], d=0;rightDepth, i=firstRow;numRows})   \
+	inout(matrix[blockIndex(bx, by, nbx, nby)])
+#endif
+	updateBlock(matrix, halo_row, halo_col, nbx, nby, bx, by, rank2D, conf, step);
+}
+
+// Block tasks grouped into outer tasks of k x k blocks (-k). The weak
+// dependencies of an outer task cover the blocks and halos of its block
+// tasks, which are linked to the neighbouring blocks and to the halo
+// transfer tasks as without the grouping.
+inline void solveSuperBlocks(block_t *matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
+{
+	const int step = conf.step;
+	const int k = conf.superBlocks;
+
+	for (int sx = 0; sx < nbx; sx += k) {
+		for (int sy = 0; sy < nby; sy += k) {
+			const int rows = std::min(k, nbx - sx);
+			const int cols = std::min(k, nby - sy);
+
+			// Each side reads a row or column of neighbouring blocks, or the halos
+			const int hasTop    = (sx > 0);
+			const int hasBottom = (sx + rows < nbx);
+			const int hasLeft   = (sy > 0);
+			const int hasRight  = (sy + cols < nby);
+
+			// A diagonal stencil also reads the corner blocks, and the halos one
+			// block further along the edges
+			const int reach = Stencil::diagonal ? 1 : 0;
+			const int firstCol = sy - reach * hasLeft;
+			const int firstRow = sx - reach * hasTop;
+			const int numCols  = cols + reach * (hasLeft + hasRight);
+			const int numRows  = rows + reach * (hasTop + hasBottom);
+
+			#pragma oss task label(gauss seidel super-block)                                              \
+				weakinout({matrix[blockIndex(i, j, nbx, nby)], i=sx;rows, j=sy;cols})                       \
+				weakin({matrix[blockIndex(sx-1, j, nbx, nby)], j=sy;cols*hasTop})                           \
+				weakin({matrix[blockIndex(sx+rows, j, nbx, nby)], j=sy;cols*hasBottom})                     \
+				weakin({matrix[blockIndex(i, sy-1, nbx, nby)], i=sx;rows*hasLeft})                          \
+				weakin({matrix[blockIndex(i, sy+cols, nbx, nby)], i=sx;rows*hasRight})                      \
+				weakin({matrix[blockIndex(sx-1, sy-1, nbx, nby)], k=0;reach*hasTop*hasLeft})                \
+				weakin({matrix[blockIndex(sx-1, sy+cols, nbx, nby)], k=0;reach*hasTop*hasRight})            \
+				weakin({matrix[blockIndex(sx+rows, sy-1, nbx, nby)], k=0;reach*hasBottom*hasLeft})          \
+				weakin({matrix[blockIndex(sx+rows, sy+cols, nbx, nby)], k=0;reach*hasBottom*hasRight})      \
+				weakin({halo_row[top][d * nby + j], d=0;HaloDepth*(1-hasTop), j=firstCol;numCols})          \
+				weakin({halo_row[bottom][d * nby + j], d=0;HaloDepth*(1-hasBottom), j=firstCol;numCols})    \
+				weakinout({halo_col[left][d * nbx + i], d=0;HaloDepth*(1-hasLeft), i=firstRow;numRows})     \
+				weakinout({halo_col[right][d * nbx + i], d=0;HaloDepth*(1-hasRight), i=firstRow;numRows})
+			for (int bx = sx; bx < sx + rows; ++bx) {
+				for (int by = sy; by < sy + cols; ++by) {
+					gaussSeidelTask(matrix, halo_row, halo_col, nbx, nby, bx, by, rank2D, conf, step);
+				}
+			}
+		}
 	}
 }
 
@@ -140,33 +353,23 @@ inline void solveGaussSeidel(block_t *matrix, row_t ** halo_row, col_t ** halo_c
 	}
 
 
-	int bsX = BSX;
-	int bsY = BSY;
+	// Block tasks of later steps are created before these run
+	const int step = conf.step;
 
-	for (int bx = 0; bx < nbx; ++bx) {
-		for (int by = 0; by < nby; ++by) {
-
-
-			block_t * topBlock    = (bx == 0)     ? nullptr : & matrix[(bx-1)*nby + by];
-			block_t * bottomBlock = (bx == nbx-1) ? nullptr : & matrix[(bx+1)*nby + by];
-			block_t * leftBlock   = (by == 0)     ? nullptr : & matrix[bx*nby + (by-1)];
-			block_t * rightBlock  = (by == nby-1) ? nullptr : & matrix[bx*nby + (by+1)];
-			row_t * haloTop       = (bx != 0)     ? nullptr : & halo_row[top][by];
-			row_t * haloBottom    = (bx != nbx-1) ? nullptr : & halo_row[bottom][by];
-			col_t * haloLeft      = (by != 0)     ? nullptr : & halo_col[left][bx];
-			col_t * haloRight     = (by != nby-1) ? nullptr : & halo_col[right][bx];
-
-			#pragma oss task label(gauss seidel)\
-			in ([1] topBlock )       \
-			in ([1] leftBlock )      \
-			in ([1] rightBlock )     \
-			in ([1] bottomBlock )    \
-			in ([1] haloTop )             \
-			in ([1] haloBottom )          \
-			inout ([1] haloLeft )            \
-			inout ([1] haloRight )           \
-			inout(([nbx][nby]matrix)[bx][by])
-			solveBlock(matrix, halo_row, halo_col, nbx, nby, bx, by, rank2D, conf);
+#ifdef HEAT_TASK_DETACH
+	// OpenMP has no weak dependencies to group the block tasks with
+	const bool grouped = false;
+#else
+	const bool grouped = (conf.superBlocks > 1);
+#endif
+
+	if (grouped) {
+		solveSuperBlocks(matrix, halo_row, halo_col, nbx, nby, rank2D, conf);
+	} else {
+		for (int i = 0; i < nbx*nby; ++i) {
+			int bx, by;
+			sweepBlock(i, nbx, nby, bx, by);
+			gaussSeidelTask(matrix, halo_row, halo_col, nbx, nby, bx, by, rank2D, conf, step);
 		}
 	}
 
@@ -179,14 +382,103 @@ inline void solveGaussSeidel(block_t *matrix, row_t ** halo_row, col_t ** halo_c
 	}
 }
 
-double solve(block_t *matrix, int rowBlocks, int colBlocks, HeatConfiguration &conf,  row_t ** halo_row, col_t ** halo_col, ProcessLayout rank2D )
+inline void solveJacobi(block_t *source, block_t *target, row_t ** halo_row, col_t ** halo_col, col_t ** sendCols, int nbx, int nby, ProcessLayout rank2D, HeatConfiguration &conf)
 {
-	for (int t = 0; t < conf.timesteps; ++t) {
-		solveGaussSeidel(matrix, halo_row, halo_col, rowBlocks, colBlocks, rank2D, conf);
+	std::vector<MPI_Request> recvs, sends;
+	postHaloExchange(source, halo_row, halo_col, sendCols, nbx, nby, rank2D, conf, recvs, sends);
+	const int step = conf.step;
+
+	// Inner blocks do not read the halos and run while the exchange completes
+	for (int i = 0; i < nbx*nby; ++i) {
+		int bx, by;
+		storedBlock(i, nbx, nby, bx, by);
+		if (!isBorderBlock(nbx, nby, bx, by)) {
+#ifdef HEAT_TASK_DETACH
+			#pragma omp task shared(conf)
+#else
+			#pragma oss task label(jacobi)
+#endif
+			jacobiBlock(source, target, halo_row, halo_col, nbx, nby, bx, by, conf, step);
+		}
 	}
 
-	#pragma oss taskwait
-	MPI_Barrier(MPI_COMM_WORLD);
+	waitHaloReceives(recvs, step);
+
+	for (int i = 0; i < nbx*nby; ++i) {
+		int bx, by;
+		storedBlock(i, nbx, nby, bx, by);
+		if (isBorderBlock(nbx, nby, bx, by)) {
+			const int atTop    = (bx == 0);
+			const int atBottom = (bx == nbx-1);
+			const int atLeft   = (by == 0);
+			const int atRight  = (by == nby-1);
+
+#ifdef HEAT_TASK_DETACH
+			#pragma omp task shared(conf)                                        \
+				depend(iterator(k=0:atTop), in: halo_row[top][by])             \
+				depend(iterator(k=0:atBottom), in: halo_row[bottom][by])       \
+				depend(iterator(k=0:atLeft), in: halo_col[left][bx])           \
+				depend(iterator(k=0:atRight), in: halo_col[right][bx])
+#else
+			#pragma oss task label(jacobi border)            \
+				in ({halo_row[top][by], k=0;atTop})         \
+				in ({halo_row[bottom][by], k=0;atBottom})   \
+				in ({halo_col[left][bx], k=0;atLeft})       \
+				in ({halo_col[right][bx], k=0;atRight})
+#endif
+			jacobiBlock(source, target, halo_row, halo_col, nbx, nby, bx, by, conf, step);
+		}
+	}
+
+	waitTasks();
+	waitAll(sends);
+}
+
+// All the tasks of a solve; they have completed when it returns
+inline void solveTasks(block_t *matrix, int rowBlocks, int colBlocks, HeatConfiguration &conf, row_t ** halo_row, col_t ** halo_col, ProcessLayout rank2D)
+{
+	if (conf.solver == JACOBI) {
+		block_t *source = matrix;
+		block_t *target = conf.nextMatrix;
+		col_t *sendCols[2];
+		sendCols[left]  = (col_t *) calloc(rowBlocks, sizeof(col_t));
+		sendCols[right] = (col_t *) calloc(rowBlocks, sizeof(col_t));
+		assert(sendCols[left] != nullptr && sendCols[right] != nullptr);
+
+		for (int t = 0; t < conf.timesteps; ++t, ++conf.step) {
+			updateHalos(conf, rowBlocks, colBlocks, rank2D);
+			solveJacobi(source, target, halo_row, halo_col, sendCols, rowBlocks, colBlocks, rank2D, conf);
+			std::swap(source, target);
+		}
+
+		// Leave the latest solution in conf.matrix
+		conf.matrix = source;
+		conf.nextMatrix = target;
+		free(sendCols[left]);
+		free(sendCols[right]);
+	} else {
+		startRequestPolling();
+		for (int t = 0; t < conf.timesteps; ++t, ++conf.step) {
+			updateHalos(conf, rowBlocks, colBlocks, rank2D);
+			solveGaussSeidel(matrix, halo_row, halo_col, rowBlocks, colBlocks, rank2D, conf);
+		}
+		waitTasks();
+		stopRequestPolling();
+	}
+
+	waitTasks();
+}
+
+double solve(block_t *matrix, int rowBlocks, int colBlocks, HeatConfiguration &conf,  row_t ** halo_row, col_t ** halo_col, ProcessLayout rank2D )
+{
+#ifdef HEAT_TASK_DETACH
+	// One thread creates the tasks and waits for them before the barrier
+	#pragma omp parallel
+	#pragma omp single
+#endif
+	solveTasks(matrix, rowBlocks, colBlocks, conf, halo_row, halo_col, rank2D);
+
+	MPI_Barrier(gridComm);
 
 	return 0.0;
 }
@@ -0,0 +1,184 @@
+#ifndef TASKAWARE_HPP
+#define TASKAWARE_HPP
+
+#include <mpi.h>
+#include <mutex>
+#include <vector>
+
+// Task-aware point-to-point communication. A communication task posts a
+// non-blocking operation and passes its request to bindRequest: the task
+// body returns at once, but its dependencies are only released once a poll
+// finds the request complete. Sends and receives on different edges and
+// blocks proceed concurrently, and no worker thread waits inside MPI.
+//
+// Every communication task declares a TaskEvent event = TaskEvent() before
+// it and passes it to bindRequest. With OmpSs-2 the event is not used: the
+// task holds an external event that a polling service of the runtime
+// releases. With OpenMP (heat_mpi.omptask), the task is created with
+// detach(event) and a polling thread fulfills the event. Without a task
+// runtime (or with the interoperability library, whose blocking calls are
+// task-aware by themselves), bindRequest waits for the request.
+//
+// OpenMP 5.0 allows fulfilling an event from a thread outside the team, but
+// libgomp (GCC 12) does not complete such a task while the team waits for it
+// in the implicit barrier of the parallel region, and hangs. The OpenMP
+// solver therefore waits for its tasks with a taskwait inside the single
+// construct that creates them, and only leaves the region when none are left.
+#if defined(_OMPSS_2) && !defined(INTEROPERABILITY)
+#include <nanos6/events.h>
+#include <nanos6/polling.h>
+#define HEAT_TASK_EVENTS
+typedef void *TaskEvent;
+#elif defined(_OPENMP) && !defined(INTEROPERABILITY)
+#include <omp.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#define HEAT_TASK_DETACH
+typedef omp_event_handle_t TaskEvent;
+#else
+typedef int TaskEvent;
+#endif
+
+#if defined(HEAT_TASK_EVENTS) || defined(HEAT_TASK_DETACH)
+
+// Requests whose tasks still hold their dependencies
+struct PendingRequests {
+	std::mutex lock;
+	std::vector<MPI_Request> requests;
+	std::vector<TaskEvent> events;
+	std::vector<int> done;
+#ifdef HEAT_TASK_DETACH
+	std::thread poller;
+	std::atomic<bool> polling;
+#endif
+};
+
+inline PendingRequests &pendingRequests()
+{
+	static PendingRequests pending;
+	return pending;
+}
+
+inline void releaseEvent(TaskEvent event)
+{
+#ifdef HEAT_TASK_EVENTS
+	nanos6_decrease_task_event_counter(event, 1);
+#else
+	omp_fulfill_event(event);
+#endif
+}
+
+// Release the tasks of the completed requests. It never waits: if another
+// thread is polling, there is nothing left to do.
+inline int pollRequests(void *)
+{
+	PendingRequests &pending = pendingRequests();
+	std::unique_lock<std::mutex> guard(pending.lock, std::try_to_lock);
+	if (!guard.owns_lock() || pending.requests.empty()) return 0;
+
+	int count;
+	pending.done.resize(pending.requests.size());
+	MPI_Testsome(pending.requests.size(), pending.requests.data(), &count, pending.done.data(), MPI_STATUSES_IGNORE);
+	if (count == MPI_UNDEFINED || count == 0) return 0;
+
+	for (int i = 0; i < count; ++i) {
+		releaseEvent(pending.events[pending.done[i]]);
+	}
+
+	// Completed requests were set to MPI_REQUEST_NULL
+	size_t kept = 0;
+	for (size_t i = 0; i < pending.requests.size(); ++i) {
+		if (pending.requests[i] != MPI_REQUEST_NULL) {
+			pending.requests[kept] = pending.requests[i];
+			pending.events[kept] = pending.events[i];
+			++kept;
+		}
+	}
+	pending.requests.resize(kept);
+	pending.events.resize(kept);
+
+	// Keep the service registered
+	return 0;
+}
+
+inline void addRequest(MPI_Request request, TaskEvent event)
+{
+#ifdef HEAT_TASK_EVENTS
+	int completed;
+	MPI_Test(&request, &completed, MPI_STATUS_IGNORE);
+	if (completed) {
+		releaseEvent(event);
+		return;
+	}
+#endif
+
+	PendingRequests &pending = pendingRequests();
+	std::lock_guard<std::mutex> guard(pending.lock);
+	pending.requests.push_back(request);
+	pending.events.push_back(event);
+}
+
+#endif
+
+#ifdef HEAT_TASK_EVENTS
+// Called from the communication task that posted the request
+inline void bindRequest(MPI_Request request, TaskEvent)
+{
+	void *counter = nanos6_get_current_event_counter();
+	nanos6_increase_current_task_event_counter(counter, 1);
+	addRequest(request, counter);
+}
+#elif defined(HEAT_TASK_DETACH)
+// Called from the communication task created with detach(event)
+inline void bindRequest(MPI_Request request, TaskEvent event)
+{
+	addRequest(request, event);
+}
+#else
+inline void bindRequest(MPI_Request request, TaskEvent)
+{
+	MPI_Wait(&request, MPI_STATUS_IGNORE);
+}
+#endif
+
+// Wait for the child tasks of the current task
+inline void waitTasks()
+{
+#ifdef HEAT_TASK_DETACH
+	#pragma omp taskwait
+#else
+	#pragma oss taskwait
+#endif
+}
+
+// Poll the pending requests while the communication tasks of a solve run;
+// stop only after they have all completed
+inline void startRequestPolling()
+{
+#ifdef HEAT_TASK_EVENTS
+	nanos6_register_polling_service("heat MPI requests", pollRequests, nullptr);
+#elif defined(HEAT_TASK_DETACH)
+	PendingRequests &pending = pendingRequests();
+	pending.polling = true;
+	pending.poller = std::thread([&pending]() {
+		while (pending.polling) {
+			pollRequests(nullptr);
+			std::this_thread::sleep_for(std::chrono::microseconds(20));
+		}
+	});
+#endif
+}
+
+inline void stopRequestPolling()
+{
+#ifdef HEAT_TASK_EVENTS
+	nanos6_unregister_polling_service("heat MPI requests", pollRequests, nullptr);
+#elif defined(HEAT_TASK_DETACH)
+	PendingRequests &pending = pendingRequests();
+	pending.polling = false;
+	pending.poller.join();
+#endif
+}
+
+#endif // TASKAWARE_HPP
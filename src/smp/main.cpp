@@ -1,7 +1,13 @@
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <vector>
 
 #include "common/heat.hpp"
+#include "common/energy.hpp"
+#include "common/ensemble.hpp"
+#include "common/field.hpp"
+#include "common/trace.hpp"
 
 #ifdef _OMPSS_2
 #include <nanos6/debug.h>
@@ -9,26 +15,110 @@
 
 #define isSingleProcess true
 
+// Each case is a task on one of the pooled grids; the cases that share a
+// grid run in order, and the others run concurrently
+static int solveEnsemble(HeatConfiguration &conf)
+{
+	std::vector<std::string> cases = readEnsembleList(conf.ensembleFileName);
+
+	refineConfiguration(conf, 1, 1, isSingleProcess);
+	printConfiguration(conf);
+
+	int rowBlocks, colBlocks;
+	decomposeConfiguration(conf, ProcessLayout(0, 0), rowBlocks, colBlocks);
+
+#ifdef _OMPSS_2
+	int numSlots = std::min((int) cases.size(), nanos_get_num_cpus());
+#else
+	int numSlots = 1;
+#endif
+	std::vector<HeatConfiguration> slots(numSlots);
+	for (int s = 0; s < numSlots; ++s) {
+		initializeSlot(slots[s], conf, rowBlocks, colBlocks);
+	}
+
+	std::vector<double> times(cases.size());
+	double start = get_time();
+	for (int c = 0; c < (int) cases.size(); ++c) {
+		HeatConfiguration &slot = slots[c % numSlots];
+
+		#pragma oss task label(ensemble case) inout(slot)
+		times[c] = solveCase(slot, rowBlocks, colBlocks, cases[c], c);
+	}
+	#pragma oss taskwait
+	double end = get_time();
+
+	printEnsemble(conf, cases, times, 1, numSlots, end - start);
+
+	for (int s = 0; s < numSlots; ++s) {
+		finalizeSlot(slots[s]);
+	}
+
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	HeatConfiguration conf = readConfiguration(argc, argv);
 
-	refineConfiguration(conf, BSX, BSY, isSingleProcess);
+	if (conf.rebalanceInterval > 0) {
+		fprintf(stderr, "Error: Load balancing is only available in MPI builds!\n");
+		return 1;
+	}
+
+	if (conf.haloCompression != COMPRESS_NONE) {
+		fprintf(stderr, "Error: Halo compression is only available in MPI builds!\n");
+		return 1;
+	}
+
+	if (!conf.ensembleFileName.empty()) {
+		if (!conf.traceFileName.empty()) {
+			fprintf(stderr, "Error: Tracing is not available in ensemble mode!\n");
+			return 1;
+		}
+		if (conf.measureEnergy) {
+			fprintf(stderr, "Error: Energy measurement is not available in ensemble mode!\n");
+			return 1;
+		}
+		if (conf.initialGuess != GUESS_NONE) {
+			fprintf(stderr, "Error: The initial guess is not available in ensemble mode!\n");
+			return 1;
+		}
+		return solveEnsemble(conf);
+	}
+
+	refineConfiguration(conf, 1, 1, isSingleProcess);
 	printConfiguration(conf);
 	
-	conf.rowBlocks = conf.rows / BSX;
-	conf.colBlocks = conf.cols / BSY;
-	int rowBlocks = conf.rowBlocks;
-	int colBlocks = conf.colBlocks;
+	int rowBlocks, colBlocks;
+	decomposeConfiguration(conf, ProcessLayout(0, 0), rowBlocks, colBlocks);
 	
-	int err = initialize(conf, colBlocks, rowBlocks);
+	int err = initialize(conf, rowBlocks, colBlocks);
 	assert(!err);
 
 	
+	if (!conf.traceFileName.empty()) startTrace();
+
+	EnergyMeter meter;
+	double joules[NUM_ENERGY_DOMAINS];
+	if (conf.measureEnergy) startEnergy(meter);
+
 	// Solve the problem
 	double start = get_time();
 	double residual = solve(conf.matrix, rowBlocks, colBlocks, conf, conf.halos_row, conf.halos_col);
 	double end = get_time();
+
+	if (conf.measureEnergy) {
+		stopEnergy(meter, joules);
+		if (meter.zones.empty()) {
+			fprintf(stderr, "Warning: No RAPL energy counters can be read, the energy is not reported!\n");
+		}
+	}
+
+	if (!conf.traceFileName.empty()) {
+		stopTrace();
+		writeTrace(conf.traceFileName, collectTrace(start, 0));
+	}
 	
 	long totalElements = (long)conf.rows * (long)conf.cols;
 	double performance = totalElements * (long)conf.timesteps;
@@ -41,13 +131,21 @@ int main(int argc, char **argv)
 	int threads = 1;
 #endif
 	
-	fprintf(stdout, "rows, %d, cols, %d, total, %ld, bs, %d, threads, %d, timesteps, %d, time, %f, performance, %f\n",
+	fprintf(stdout, "rows, %d, cols, %d, total, %ld, bs, %d, threads, %d, timesteps, %d, time, %f, performance, %f",
 		conf.rows, conf.cols, totalElements, BSX, threads, conf.timesteps, end - start, performance);
+	if (!meter.zones.empty()) {
+		printEnergy(joules, end - start, (double) totalElements * conf.timesteps);
+	}
+	fprintf(stdout, "\n");
 	
 	if (conf.generateImage) {
-		err = writeImage(conf.imageFileName, conf.matrix, rowBlocks, colBlocks);
+		err = writeImage(conf.imageFileName, conf.matrix, rowBlocks, colBlocks, conf.rows, conf.cols);
 		assert(!err);
 	}
+
+	if (conf.generateField) {
+		writeField(conf.fieldFileName, conf.matrix, rowBlocks, colBlocks, conf.rows, conf.cols, conf.compressField);
+	}
 	
 	err = finalize(conf);
 	assert(!err);
@@ -2,69 +2,208 @@
 #include <iostream>
 
 #include "common/heat.hpp"
+#include "common/activity.hpp"
+#include "common/jacobi.hpp"
+#include "common/multigrid.hpp"
+#include "common/padded.hpp"
+#include "common/stencil.hpp"
 
 
-inline double solveBlock(block_t *matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by)
+// Update one block unless active-region tracking shows that it cannot change
+inline double updateBlock(block_t *matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, const HeatConfiguration &conf, int step)
 {
-	block_t &targetBlock = matrix[bx*nby + by];
-	const block_t &centerBlock = matrix[bx*nby + by];
-	const block_t &topBlock    = matrix[(bx-1)*nby + by];
-	const block_t &leftBlock   = matrix[bx*nby + (by-1)];
-	const block_t &rightBlock  = matrix[bx*nby + (by+1)];
-	const block_t &bottomBlock = matrix[(bx+1)*nby + by];
+	double *change = conf.blockChange;
+	if (change != nullptr && !isBlockActive(change, nbx, nby, bx, by, conf.activeTolerance)) {
+		change[blockIndex(bx, by, nbx, nby)] = 0.0;
+		return 0.0;
+	}
+
+	const int nx = (bx == nbx-1) ? conf.lastBlockRows : BSX;
+	const int ny = (by == nby-1) ? conf.lastBlockCols : BSY;
+	const double traced = traceBegin();
+
+	double sum = solveStencil(matrix, halo_row, halo_col, BoundaryHalos, nbx, nby, bx, by, nx, ny, conf.omega);
+
+	if (change != nullptr) {
+		change[blockIndex(bx, by, nbx, nby)] = sum;
+	}
+	traceEnd(TRACE_BLOCK, bx, by, step, traced);
 
-	const row_t &haloTop    = (bx == 0)    ? halo_row[top]   [by] : topBlock[BSX-1];
-	const row_t &haloBottom = (bx == nbx-1)? halo_row[bottom][by] : bottomBlock[0];
+	return sum;
+}
+
+// Task updating block (bx, by) after its neighbours and halos. A diagonal
+// stencil also reads the diagonal blocks and, along the grid edges, the
+// halo segments of the neighbouring blocks.
+inline void gaussSeidelTask(block_t * matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, const HeatConfiguration &conf, int step)
+{
+	const int reach = Stencil::diagonal ? 1 : 0;
+	block_t * topBlock    = (bx == 0)     ? nullptr : & matrix[blockIndex(bx-1, by, nbx, nby)];
+	block_t * bottomBlock = (bx == nbx-1) ? nullptr : & matrix[blockIndex(bx+1, by, nbx, nby)];
+	block_t * leftBlock   = (by == 0)     ? nullptr : & matrix[blockIndex(bx, by-1, nbx, nby)];
+	block_t * rightBlock  = (by == nby-1) ? nullptr : & matrix[blockIndex(bx, by+1, nbx, nby)];
+	block_t * topLeftBlock     = (!reach || bx == 0     || by == 0)     ? nullptr : & matrix[blockIndex(bx-1, by-1, nbx, nby)];
+	block_t * topRightBlock    = (!reach || bx == 0     || by == nby-1) ? nullptr : & matrix[blockIndex(bx-1, by+1, nbx, nby)];
+	block_t * bottomLeftBlock  = (!reach || bx == nbx-1 || by == 0)     ? nullptr : & matrix[blockIndex(bx+1, by-1, nbx, nby)];
+	block_t * bottomRightBlock = (!reach || bx == nbx-1 || by == nby-1) ? nullptr : & matrix[blockIndex(bx+1, by+1, nbx, nby)];
 
-	double sum = 0.0;
-	for (int x = 0; x < BSX; ++x) {
+	// Halo segments along the row and the column of the block
+	const int firstCol = std::max(by - reach, 0);
+	const int firstRow = std::max(bx - reach, 0);
+	const int numCols  = std::min(by + reach, nby-1) - firstCol + 1;
+	const int numRows  = std::min(bx + reach, nbx-1) - firstRow + 1;
+	const int topCols     = (bx != 0)     ? 0 : numCols;
+	const int bottomCols  = (bx != nbx-1) ? 0 : numCols;
+	const int leftRows    = (by != 0)     ? 0 : numRows;
+	const int rightRows   = (by != nby-1) ? 0 : numRows;
 
-		const row_t &topRow    = (x > 0)     ? centerBlock[x-1] : haloTop;
-		const row_t &bottomRow = (x < BSX-1) ? centerBlock[x+1] : haloBottom;
+	#pragma oss task label(gauss seidel) \
+		in ([1]topBlock)              \
+		in ([1]leftBlock)             \
+		in ([1]rightBlock)            \
+		in ([1]bottomBlock)           \
+		in ([1]topLeftBlock)          \
+		in ([1]topRightBlock)         \
+		in ([1]bottomLeftBlock)       \
+		in ([1]bottomRightBlock)      \
+		in ({halo_row[top][j], j=firstCol;topCols})          \
+		in ({halo_row[bottom][j], j=firstCol;bottomCols})    \
+		in ({halo_col[left][i], i=firstRow;leftRows})        \
+		in ({halo_col[right][i], i=firstRow;rightRows})      \
+		inout(matrix[blockIndex(bx, by, nbx, nby)])
+	updateBlock(matrix, halo_row, halo_col, nbx, nby, bx, by, conf, step);
+}
 
-		const double halo_left_element  = (by == 0)     ? halo_col[left] [bx][x] : leftBlock [x][BSY-1];
-		const double halo_right_element = (by == nby-1) ? halo_col[right][bx][x] : rightBlock[x][0];
+// Sweep in super-blocks of k x k blocks (-k). Each super-block is an outer
+// task that creates the block tasks of its blocks; its weak dependencies
+// cover every block and halo they access, so it never waits itself and the
+// block tasks still depend on those of the neighbouring super-blocks. The
+// runtime tracks the few outer tasks at the top level, while the block tasks
+// are created in parallel and keep the wavefront of small blocks.
+inline void superBlockSolver(block_t * matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, const HeatConfiguration &conf)
+{
+	const int step = conf.step;
+	const int k = conf.superBlocks;
 
-		for (int y = 0; y < BSY; ++y) {
+	for (int sx = 0; sx < nbx; sx += k) {
+		for (int sy = 0; sy < nby; sy += k) {
+			const int rows = std::min(k, nbx - sx);
+			const int cols = std::min(k, nby - sy);
 
-			double leftElement  = (y > 0)     ? centerBlock[x][y-1] : halo_left_element;
-			double rightElement = (y < BSY-1) ? centerBlock[x][y+1] : halo_right_element;
+			// Each side reads a row or column of neighbouring blocks, or the halos
+			const int hasTop    = (sx > 0);
+			const int hasBottom = (sx + rows < nbx);
+			const int hasLeft   = (sy > 0);
+			const int hasRight  = (sy + cols < nby);
 
-			double value = 0.25 * (topRow[y] + bottomRow[y] + leftElement + rightElement);
-			double diff = value - targetBlock[x][y];
-			sum += diff * diff;
+			// A diagonal stencil also reads the corner blocks, and the halos one
+			// block further along the edges
+			const int reach = Stencil::diagonal ? 1 : 0;
+			block_t * topLeftBlock     = (reach && hasTop && hasLeft)     ? & matrix[blockIndex(sx-1, sy-1, nbx, nby)] : nullptr;
+			block_t * topRightBlock    = (reach && hasTop && hasRight)    ? & matrix[blockIndex(sx-1, sy+cols, nbx, nby)] : nullptr;
+			block_t * bottomLeftBlock  = (reach && hasBottom && hasLeft)  ? & matrix[blockIndex(sx+rows, sy-1, nbx, nby)] : nullptr;
+			block_t * bottomRightBlock = (reach && hasBottom && hasRight) ? & matrix[blockIndex(sx+rows, sy+cols, nbx, nby)] : nullptr;
+			const int firstCol = sy - reach * hasLeft;
+			const int firstRow = sx - reach * hasTop;
+			const int numCols  = cols + reach * (hasLeft + hasRight);
+			const int numRows  = rows + reach * (hasTop + hasBottom);
 
-			targetBlock[x][y] = value;
+			#pragma oss task label(gauss seidel super-block)                                              \
+				weakinout({matrix[blockIndex(i, j, nbx, nby)], i=sx;rows, j=sy;cols})                       \
+				weakin({matrix[blockIndex(sx-1, j, nbx, nby)], j=sy;cols*hasTop})                           \
+				weakin({matrix[blockIndex(sx+rows, j, nbx, nby)], j=sy;cols*hasBottom})                     \
+				weakin({matrix[blockIndex(i, sy-1, nbx, nby)], i=sx;rows*hasLeft})                          \
+				weakin({matrix[blockIndex(i, sy+cols, nbx, nby)], i=sx;rows*hasRight})                      \
+				weakin([1]topLeftBlock)                                                                     \
+				weakin([1]topRightBlock)                                                                    \
+				weakin([1]bottomLeftBlock)                                                                  \
+				weakin([1]bottomRightBlock)                                                                 \
+				weakin({halo_row[top][j], j=firstCol;numCols*(1-hasTop)})                                   \
+				weakin({halo_row[bottom][j], j=firstCol;numCols*(1-hasBottom)})                             \
+				weakin({halo_col[left][i], i=firstRow;numRows*(1-hasLeft)})                                 \
+				weakin({halo_col[right][i], i=firstRow;numRows*(1-hasRight)})
+			for (int bx = sx; bx < sx + rows; ++bx) {
+				for (int by = sy; by < sy + cols; ++by) {
+					gaussSeidelTask(matrix, halo_row, halo_col, nbx, nby, bx, by, conf, step);
+				}
+			}
 		}
 	}
-
-	return sum;
 }
 
-inline void gaussSeidelSolver(block_t * matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby)
+inline void gaussSeidelSolver(block_t * matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, const HeatConfiguration &conf)
 {
-	double unew, diff, sum = 0.0;
+	if (conf.superBlocks > 1) {
+		superBlockSolver(matrix, halo_row, halo_col, nbx, nby, conf);
+		return;
+	}
 
-	int bsX = BSX;
-	int bsY = BSY;
+	// The tasks run after conf.step has moved on
+	const int step = conf.step;
 
-	for (int bx = 0; bx < nbx; ++bx) {
-		for (int by = 0; by < nby; ++by) {
+	for (int i = 0; i < nbx*nby; ++i) {
+		int bx, by;
+		sweepBlock(i, nbx, nby, bx, by);
+		gaussSeidelTask(matrix, halo_row, halo_col, nbx, nby, bx, by, conf, step);
+	}
+}
 
+inline void paddedSolver(paddedBlock_t *padded, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, const HeatConfiguration &conf)
+{
+	const int step = conf.step;
+	for (int i = 0; i < nbx*nby; ++i) {
+		int bx, by;
+		sweepBlock(i, nbx, nby, bx, by);
+		paddedBlock_t * topBlock    = (bx == 0)     ? nullptr : & padded[blockIndex(bx-1, by, nbx, nby)];
+		paddedBlock_t * bottomBlock = (bx == nbx-1) ? nullptr : & padded[blockIndex(bx+1, by, nbx, nby)];
+		paddedBlock_t * leftBlock   = (by == 0)     ? nullptr : & padded[blockIndex(bx, by-1, nbx, nby)];
+		paddedBlock_t * rightBlock  = (by == nby-1) ? nullptr : & padded[blockIndex(bx, by+1, nbx, nby)];
+		row_t * haloTop       = (bx != 0)     ? nullptr : & halo_row[top][by];
+		row_t * haloBottom    = (bx != nbx-1) ? nullptr : & halo_row[bottom][by];
+		col_t * haloLeft      = (by != 0)     ? nullptr : & halo_col[left][bx];
+		col_t * haloRight     = (by != nby-1) ? nullptr : & halo_col[right][bx];
 
-			block_t * topBlock    = (bx == 0)     ? nullptr : & matrix[(bx-1)*nby + by];
-			block_t * bottomBlock = (bx == nbx-1) ? nullptr : & matrix[(bx+1)*nby + by];
-			block_t * leftBlock   = (by == 0)     ? nullptr : & matrix[bx*nby + (by-1)];
-			block_t * rightBlock  = (by == nby-1) ? nullptr : & matrix[bx*nby + (by+1)];
+		#pragma oss task label(padded gauss seidel) \
+			in ([1]topBlock)                     \
+			in ([1]leftBlock)                    \
+			in ([1]rightBlock)                   \
+			in ([1]bottomBlock)                  \
+			in ([1]haloTop)                      \
+			in ([1]haloBottom)                   \
+			in ([1]haloLeft)                     \
+			in ([1]haloRight)                    \
+			inout(padded[blockIndex(bx, by, nbx, nby)])
+		updatePaddedBlock(padded, halo_row, halo_col, nbx, nby, bx, by, conf, step);
+	}
+}
 
-			#pragma oss task label(gauss seidel) \
-				in ([1]topBlock)              \
-				in ([1]leftBlock)             \
-				in ([1]rightBlock)            \
-				in ([1]bottomBlock)           \
-				inout(([nbx][nby]matrix)[bx][by])
-			solveBlock(matrix, halo_row, halo_col, nbx, nby, bx, by);
-		}
+inline void jacobiSolver(block_t *source, block_t *target, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, const HeatConfiguration &conf)
+{
+	const int step = conf.step;
+	for (int i = 0; i < nbx*nby; ++i) {
+		int bx, by;
+		storedBlock(i, nbx, nby, bx, by);
+		block_t * topBlock    = (bx == 0)     ? nullptr : & source[blockIndex(bx-1, by, nbx, nby)];
+		block_t * bottomBlock = (bx == nbx-1) ? nullptr : & source[blockIndex(bx+1, by, nbx, nby)];
+		block_t * leftBlock   = (by == 0)     ? nullptr : & source[blockIndex(bx, by-1, nbx, nby)];
+		block_t * rightBlock  = (by == nby-1) ? nullptr : & source[blockIndex(bx, by+1, nbx, nby)];
+		row_t * haloTop       = (bx != 0)     ? nullptr : & halo_row[top][by];
+		row_t * haloBottom    = (bx != nbx-1) ? nullptr : & halo_row[bottom][by];
+		col_t * haloLeft      = (by != 0)     ? nullptr : & halo_col[left][bx];
+		col_t * haloRight     = (by != nby-1) ? nullptr : & halo_col[right][bx];
+
+		#pragma oss task label(jacobi)                \
+			in ([1]topBlock)                           \
+			in ([1]leftBlock)                          \
+			in ([1]rightBlock)                         \
+			in ([1]bottomBlock)                        \
+			in ([1]haloTop)                            \
+			in ([1]haloBottom)                         \
+			in ([1]haloLeft)                           \
+			in ([1]haloRight)                          \
+			in (source[blockIndex(bx, by, nbx, nby)])  \
+			out(target[blockIndex(bx, by, nbx, nby)])
+		jacobiBlock(source, target, halo_row, halo_col, nbx, nby, bx, by, conf, step);
 	}
 }
 
@@ -72,8 +211,56 @@ double solve(block_t *matrix, int rowBlocks, int colBlocks, HeatConfiguration &c
 {
 	double residual = 0.0;
 
-	for (int t = 0; t < conf.timesteps; ++t) {
-		gaussSeidelSolver(matrix, halos_row, halos_col, rowBlocks, colBlocks);
+	if (conf.solver == MULTIGRID) {
+		MultigridHierarchy mg;
+		createHierarchy(mg, conf.rows, conf.cols, conf.mgCycle);
+
+		// The grid transfers run in the creating thread, so every smoothing
+		// sweep has to finish before they start
+		for (int t = 0; t < conf.timesteps; ++t, ++conf.step) {
+			updateHalos(conf, rowBlocks, colBlocks);
+			multigridCycle(matrix, halos_row, halos_col, rowBlocks, colBlocks, conf.rows, conf.cols, mg, [&]() {
+				gaussSeidelSolver(matrix, halos_row, halos_col, rowBlocks, colBlocks, conf);
+				#pragma oss taskwait
+			});
+		}
+
+		destroyHierarchy(mg);
+		return residual;
+	}
+
+	if (conf.solver == JACOBI) {
+		block_t *source = matrix;
+		block_t *target = conf.nextMatrix;
+
+		// Consecutive steps only depend on the neighbouring blocks
+		for (int t = 0; t < conf.timesteps; ++t, ++conf.step) {
+			updateHalos(conf, rowBlocks, colBlocks);
+			jacobiSolver(source, target, halos_row, halos_col, rowBlocks, colBlocks, conf);
+			std::swap(source, target);
+		}
+		#pragma oss taskwait
+
+		// Leave the latest solution in conf.matrix
+		conf.matrix = source;
+		conf.nextMatrix = target;
+		return residual;
+	}
+
+	if (conf.paddedBlocks) {
+		paddedBlock_t *padded = enterPadded(conf, matrix, rowBlocks, colBlocks);
+		for (int t = 0; t < conf.timesteps; ++t, ++conf.step) {
+			updateHalos(conf, rowBlocks, colBlocks);
+			paddedSolver(padded, halos_row, halos_col, rowBlocks, colBlocks, conf);
+		}
+		#pragma oss taskwait
+		leavePadded(conf, matrix, rowBlocks, colBlocks);
+		return residual;
+	}
+
+	for (int t = 0; t < conf.timesteps; ++t, ++conf.step) {
+		updateHalos(conf, rowBlocks, colBlocks);
+		gaussSeidelSolver(matrix, halos_row, halos_col, rowBlocks, colBlocks, conf);
 	}
 	#pragma oss taskwait
 
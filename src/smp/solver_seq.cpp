@@ -2,64 +2,119 @@
 #include <iostream>
 
 #include "common/heat.hpp"
+#include "common/activity.hpp"
+#include "common/jacobi.hpp"
+#include "common/multigrid.hpp"
+#include "common/padded.hpp"
+#include "common/stencil.hpp"
 
 
-inline double solveBlock(block_t *matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by)
+// Update one block unless active-region tracking shows that it cannot change
+inline double updateBlock(block_t *matrix, row_t ** halo_row, col_t ** halo_col, int nbx, int nby, int bx, int by, const HeatConfiguration &conf, int step)
 {
-	block_t &targetBlock = matrix[bx*nby + by];
-	const block_t &centerBlock = matrix[bx*nby + by];
-	const block_t &topBlock    = matrix[(bx-1)*nby + by];
-	const block_t &leftBlock   = matrix[bx*nby + (by-1)];
-	const block_t &rightBlock  = matrix[bx*nby + (by+1)];
-	const block_t &bottomBlock = matrix[(bx+1)*nby + by];
-
-	const row_t &haloTop    = (bx == 0)    ? halo_row[top]   [by] : topBlock[BSX-1];
-	const row_t &haloBottom = (bx == nbx-1)? halo_row[bottom][by] : bottomBlock[0];
-
-	double sum = 0.0;
-	for (int x = 0; x < BSX; ++x) {
-
-		const row_t &topRow    = (x > 0)     ? centerBlock[x-1] : haloTop;
-		const row_t &bottomRow = (x < BSX-1) ? centerBlock[x+1] : haloBottom;
-		
-		const double halo_left_element  = (by == 0)     ? halo_col[left] [bx][x] : leftBlock [x][BSY-1];
-		const double halo_right_element = (by == nby-1) ? halo_col[right][bx][x] : rightBlock[x][0];
+	double *change = conf.blockChange;
+	if (change != nullptr && !isBlockActive(change, nbx, nby, bx, by, conf.activeTolerance)) {
+		change[blockIndex(bx, by, nbx, nby)] = 0.0;
+		return 0.0;
+	}
 
-		for (int y = 0; y < BSY; ++y) {
+	const int nx = (bx == nbx-1) ? conf.lastBlockRows : BSX;
+	const int ny = (by == nby-1) ? conf.lastBlockCols : BSY;
+	const double traced = traceBegin();
 
-			double leftElement  = (y > 0)     ? centerBlock[x][y-1] : halo_left_element;
-			double rightElement = (y < BSY-1) ? centerBlock[x][y+1] : halo_right_element;
-			
-			double value = 0.25 * (topRow[y] + bottomRow[y] + leftElement + rightElement);
-			double diff = value - targetBlock[x][y];
-			sum += diff * diff;
+	double sum = solveStencil(matrix, halo_row, halo_col, BoundaryHalos, nbx, nby, bx, by, nx, ny, conf.omega);
 
-			targetBlock[x][y] = value;
-		}
+	if (change != nullptr) {
+		change[blockIndex(bx, by, nbx, nby)] = sum;
 	}
-	
+	traceEnd(TRACE_BLOCK, bx, by, step, traced);
+
 	return sum;
 }
 
-inline double gaussSeidelSolver(block_t *matrix, row_t ** halos_row, col_t ** halos_col, int nbx, int nby)
+inline double gaussSeidelSolver(block_t *matrix, row_t ** halos_row, col_t ** halos_col, int nbx, int nby, const HeatConfiguration &conf)
 {
 	double unew, diff, sum = 0.0;
 	
-	for (int bx = 0; bx < nbx; ++bx) {
-		for (int by = 0; by < nby; ++by) {
-			sum += solveBlock(matrix, halos_row, halos_col, nbx, nby, bx, by);
-		}
+	for (int i = 0; i < nbx*nby; ++i) {
+		int bx, by;
+		sweepBlock(i, nbx, nby, bx, by);
+		sum += updateBlock(matrix, halos_row, halos_col, nbx, nby, bx, by, conf, conf.step);
+	}
+
+	return sum;
+}
+
+inline double paddedSolver(paddedBlock_t *padded, row_t ** halos_row, col_t ** halos_col, int nbx, int nby, const HeatConfiguration &conf)
+{
+	double sum = 0.0;
+
+	for (int i = 0; i < nbx*nby; ++i) {
+		int bx, by;
+		sweepBlock(i, nbx, nby, bx, by);
+		sum += updatePaddedBlock(padded, halos_row, halos_col, nbx, nby, bx, by, conf, conf.step);
 	}
 
 	return sum;
 }
 
+inline void jacobiSolver(block_t *source, block_t *target, row_t ** halos_row, col_t ** halos_col, int nbx, int nby, const HeatConfiguration &conf)
+{
+	for (int i = 0; i < nbx*nby; ++i) {
+		int bx, by;
+		storedBlock(i, nbx, nby, bx, by);
+		jacobiBlock(source, target, halos_row, halos_col, nbx, nby, bx, by, conf, conf.step);
+	}
+}
+
 double solve(block_t *matrix, int rowBlocks, int colBlocks, HeatConfiguration &conf,  row_t ** halos_row, col_t ** halos_col, ProcessLayout rank2D)
 {
 	double residual = 0.0;
+
+	if (conf.solver == MULTIGRID) {
+		MultigridHierarchy mg;
+		createHierarchy(mg, conf.rows, conf.cols, conf.mgCycle);
+
+		for (int t = 0; t < conf.timesteps; ++t, ++conf.step) {
+			updateHalos(conf, rowBlocks, colBlocks);
+			multigridCycle(matrix, halos_row, halos_col, rowBlocks, colBlocks, conf.rows, conf.cols, mg, [&]() {
+				residual = gaussSeidelSolver(matrix, halos_row, halos_col, rowBlocks, colBlocks, conf);
+			});
+		}
+
+		destroyHierarchy(mg);
+		return residual;
+	}
+
+	if (conf.solver == JACOBI) {
+		block_t *source = matrix;
+		block_t *target = conf.nextMatrix;
+
+		for (int t = 0; t < conf.timesteps; ++t, ++conf.step) {
+			updateHalos(conf, rowBlocks, colBlocks);
+			jacobiSolver(source, target, halos_row, halos_col, rowBlocks, colBlocks, conf);
+			std::swap(source, target);
+		}
+
+		// Leave the latest solution in conf.matrix
+		conf.matrix = source;
+		conf.nextMatrix = target;
+		return residual;
+	}
 	
-	for (int t = 0; t < conf.timesteps; ++t) {
-		residual = gaussSeidelSolver(matrix, halos_row, halos_col, rowBlocks, colBlocks);
+	if (conf.paddedBlocks) {
+		paddedBlock_t *padded = enterPadded(conf, matrix, rowBlocks, colBlocks);
+		for (int t = 0; t < conf.timesteps; ++t, ++conf.step) {
+			updateHalos(conf, rowBlocks, colBlocks);
+			residual = paddedSolver(padded, halos_row, halos_col, rowBlocks, colBlocks, conf);
+		}
+		leavePadded(conf, matrix, rowBlocks, colBlocks);
+		return residual;
+	}
+
+	for (int t = 0; t < conf.timesteps; ++t, ++conf.step) {
+		updateHalos(conf, rowBlocks, colBlocks);
+		residual = gaussSeidelSolver(matrix, halos_row, halos_col, rowBlocks, colBlocks, conf);
 	}
 
 	return residual;
@@ -0,0 +1,117 @@
+#include <getopt.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "common/field.hpp"
+
+// Field file tool: prints the header of a field file (-F), or the values of
+// a rectangle of its grid. The file is mapped, so only the blocks that
+// overlap the rectangle are read.
+
+static void printUsage(char **argv)
+{
+	fprintf(stdout, "Usage: %s [OPTION]... FILE [ROW COL ROWS COLS]\n", argv[0]);
+	fprintf(stdout, "Print the grid and block sizes of a field file, or the ROWS x COLS values from (ROW, COL),\n");
+	fprintf(stdout, "one grid row per line.\n\n");
+	fprintf(stdout, "Optional parameters:\n");
+	fprintf(stdout, "  -b, --binary\t\t\twrite the values raw, in the precision and byte order of the file\n");
+	fprintf(stdout, "  -h, --help\t\t\tdisplay this help and exit\n\n");
+}
+
+static void printHeader(const FieldHeader &header, const FieldTile *index, size_t fileSize)
+{
+	const int numTiles = header.rowBlocks * header.colBlocks;
+	double rawSize = fieldDataOffset(numTiles) + (double) numTiles * header.blockRows * header.blockCols * header.valueSize;
+
+	fprintf(stdout, "Rows x Cols       : %d x %d\n", header.rows, header.cols);
+	fprintf(stdout, "Blocks            : %d x %d of %d x %d\n", header.rowBlocks, header.colBlocks, header.blockRows, header.blockCols);
+	fprintf(stdout, "Storage precision : %s\n", (header.valueSize == sizeof(float)) ? "float" : "double");
+	fprintf(stdout, "Block coding      : %s\n", (header.flags & FIELD_CODED) ? "coded" : "raw");
+	fprintf(stdout, "File size         : %lu bytes (%.3f of raw)\n", (unsigned long) fileSize, fileSize / rawSize);
+
+	uint64_t smallest = UINT64_MAX, largest = 0;
+	for (int t = 0; t < numTiles; ++t) {
+		smallest = std::min(smallest, index[t].size);
+		largest = std::max(largest, index[t].size);
+	}
+	fprintf(stdout, "Block bytes       : %lu to %lu\n", (unsigned long) smallest, (unsigned long) largest);
+}
+
+// Print the values of the rectangle
+template <typename Real>
+static void extract(const FieldFile &field, int row, int col, int rows, int cols, bool binary)
+{
+	std::vector<Real> values((size_t) rows * cols);
+	readFieldRegion<Real>(field, row, col, rows, cols, values.data());
+
+	if (binary) {
+		fwrite(values.data(), sizeof(Real), values.size(), stdout);
+		return;
+	}
+
+	const int digits = (sizeof(Real) == sizeof(float)) ? 9 : 17;
+	for (int x = 0; x < rows; ++x) {
+		for (int y = 0; y < cols; ++y) {
+			fprintf(stdout, (y + 1 < cols) ? "%.*g " : "%.*g\n", digits, (double) values[(size_t) x * cols + y]);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"binary", no_argument, 0, 'b'},
+		{"help",   no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	bool binary = false;
+	int c;
+	while ((c = getopt_long(argc, argv, "bh", long_options, nullptr)) != -1) {
+		switch (c) {
+			case 'b':
+				binary = true;
+				break;
+			case 'h':
+				printUsage(argv);
+				return 0;
+			default:
+				return 1;
+		}
+	}
+
+	const int numArgs = argc - optind;
+	if (numArgs != 1 && numArgs != 5) {
+		printUsage(argv);
+		return 1;
+	}
+	const char *fileName = argv[optind];
+
+	FieldFile field = openFieldFile(fileName);
+	const FieldHeader &header = field.header;
+
+	if (numArgs == 1) {
+		printHeader(header, field.index, field.size);
+	} else {
+		const int row = atoi(argv[optind + 1]);
+		const int col = atoi(argv[optind + 2]);
+		const int rows = atoi(argv[optind + 3]);
+		const int cols = atoi(argv[optind + 4]);
+		if (row < 0 || col < 0 || rows <= 0 || cols <= 0 || row + rows > header.rows || col + cols > header.cols) {
+			fprintf(stderr, "Error: The rectangle must lie within the %d x %d grid!\n", header.rows, header.cols);
+			return 1;
+		}
+
+		if (header.valueSize == sizeof(float)) {
+			extract<float>(field, row, col, rows, cols, binary);
+		} else {
+			extract<double>(field, row, col, rows, cols, binary);
+		}
+	}
+
+	closeFieldFile(field);
+	return 0;
+}